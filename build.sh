@@ -1,8 +1,45 @@
 #!/run/current-system/sw/bin/bash
 
+CommonFlags="-std=c++17 -Wall -Wextra -Wpedantic -Werror -Wconversion -Wno-gnu-anonymous-struct -Wno-nested-anon-types"
+
+# NOTE: `./build.sh release` builds an optimized game into build_release,
+# with the game library optimized using a profile of handmade_bench --train
+# playing frames through an instrumented copy of it. Both copies are built
+# from handmade.cpp with the same flags, the profile only matches the code it
+# was taken from.
+if [ "$1" = "release" ]; then
+  mkdir -p build_release
+  pushd build_release > /dev/null
+  rm -f *.profraw && \
+  clang++ ../src/handmade.cpp $CommonFlags -o libhandmade_train.so -O2 -fprofile-instr-generate -shared -fPIC -pthread && \
+  clang++ ../src/linux_bench.cpp $CommonFlags -o handmade_bench -O2 -pthread -ldl && \
+  clang++ ../src/handmade_packer.cpp $CommonFlags -o handmade_packer -O2 && \
+  ./handmade_packer ../data handmade.hha && \
+  LLVM_PROFILE_FILE="handmade-%p.profraw" ./handmade_bench --train ./libhandmade_train.so && \
+  llvm-profdata merge -o handmade.profdata *.profraw && \
+  clang++ ../src/handmade.cpp $CommonFlags -o libhandmade.so.tmp -O2 -fprofile-instr-use=handmade.profdata -shared -fPIC -pthread && \
+  mv libhandmade.so.tmp libhandmade.so && \
+  clang++ ../src/linux_handmade.cpp $CommonFlags -o handmade -O2 -lX11 -lXext -lXrandr -levdev -lasound -ldl -pthread
+  popd > /dev/null
+  exit
+fi
+
 mkdir -p build
 pushd build/ > /dev/null
-# Add -m32 to compile for 32bits
-clang++ ../src/linux_handmade.cpp -DHANDMADE_SLOW -DHANDMADE_INTERNAL -std=c++17 -o handmade -g3 -O0 -Wall -Wextra -Wpedantic -Werror -Wconversion -Wno-gnu-anonymous-struct -Wno-nested-anon-types -lX11 -levdev -lasound && \
-./handmade
+# NOTE: The game layer is built under a temporary name and renamed, so a
+# running ./handmade never loads a half written library. `./build.sh game`
+# stops here, ./handmade picks the new library up on its own.
+clang++ ../src/handmade.cpp -DHANDMADE_SLOW -DHANDMADE_INTERNAL $CommonFlags -o libhandmade.so.tmp -g3 -O0 -shared -fPIC -pthread && \
+mv libhandmade.so.tmp libhandmade.so && \
+if [ "$1" != "game" ]; then
+  # Add -m32 to compile for 32bits
+  # NOTE: The headless target is optimized since it's used to measure the game
+  # layer's throughput
+  clang++ ../src/linux_headless.cpp -DHANDMADE_INTERNAL $CommonFlags -o handmade_headless -g -O2 -pthread && \
+  clang++ ../src/linux_bench.cpp $CommonFlags -o handmade_bench -g -O2 -pthread -ldl && \
+  clang++ ../src/handmade_packer.cpp $CommonFlags -o handmade_packer -g -O2 && \
+  ./handmade_packer ../data handmade.hha && \
+  clang++ ../src/linux_handmade.cpp -DHANDMADE_SLOW -DHANDMADE_INTERNAL $CommonFlags -o handmade -g3 -O0 -lX11 -lXext -lXrandr -levdev -lasound -ldl -pthread && \
+  ./handmade
+fi
 popd > /dev/null
@@ -28,6 +28,8 @@
 
           buildInputs = with pkgs; [
             xorg.libX11
+            xorg.libXext
+            xorg.libXrandr
             xorg.xorgproto
             libevdev
             alsa-lib
@@ -1,83 +1,275 @@
 #include "handmade.h"
 
-constexpr float PI_32 = 3.14159265359f;
+#include "handmade_asset.cpp"
+#include "handmade_audio.cpp"
+#include "handmade_render.cpp"
+#include "handmade_render_group.cpp"
 
-static void game_output_sound(const GameSoundOutputBuffer &sound_buffer,
-                              const int32_t frequency) {
-  static float t_sine;
-  const int16_t amplitude = 3000;
-  int32_t wave_period = (int32_t)sound_buffer.samples_per_second / frequency;
+static inline bool was_pressed(const GameButtonState &button) {
+  return button.ended_down && button.half_transition_count > 0;
+}
 
-  int16_t *sample_out = sound_buffer.samples;
+// NOTE: Either entry point may be the first one the platform calls
+static void initialize_game(GameMemory &memory) {
+  ASSERT(sizeof(GameState) <= memory.permanent_storage_size);
+  GameState *game_state = (GameState *)memory.permanent_storage;
+  if (!memory.is_initialized) {
+#if HANDMADE_INTERNAL
+    PlatformFileHandle file =
+        memory.platform_open_file(__FILE__, PlatformFileUsage::WholeFile);
+    if (file.no_errors && file.content) {
+      memory.DEBUG_platform_write_entire_file("text.txt", file.size,
+                                              file.content);
+    }
+    memory.platform_close_file(&file);
+#endif
 
-  for (uint32_t i = 0; i < sound_buffer.sample_count; ++i) {
-    float sine_value = sinf(t_sine);
-    int16_t sample_value = (int16_t)(sine_value * amplitude);
-    *sample_out++ = sample_value;
-    *sample_out++ = sample_value;
+    initialize_arena(&game_state->world_arena,
+                     memory.permanent_storage_size - sizeof(GameState),
+                     (uint8_t *)memory.permanent_storage + sizeof(GameState));
 
-    t_sine += 2.0f * PI_32 * 1.0f / (float)wave_period;
-  }
-}
+    game_state->frequency = 256;
+    game_state->world.player_x = 100.0f;
+    game_state->world.player_y = 100.0f;
+    game_state->previous_world = game_state->world;
 
-static void render_weird_gradient(const GameOffscreenBuffer &buffer,
-                                  const int blue_offset,
-                                  const int green_offset) {
-  uint8_t *row = (uint8_t *)buffer.memory;
+    initialize_audio_state(&game_state->audio_state, 1.0f);
+    game_state->tone_sound =
+        play_tone(&game_state->audio_state, (float)game_state->frequency,
+                  3000.0f / 32767.0f, 0.0f);
+    if (open_audio_stream(memory, &game_state->world_arena,
+                          &game_state->music_stream, "../data/music.wav")) {
+      play_stream(&game_state->audio_state, &game_state->music_stream, 0.5f,
+                  0.0f);
+    }
 
-  for (uint32_t y = 0; y < buffer.height; ++y) {
-    uint32_t *pixel = (uint32_t *)row;
-    for (uint32_t x = 0; x < buffer.width; ++x) {
-      uint8_t blue = (uint8_t)((int)x + blue_offset);
-      uint8_t green = (uint8_t)((int)y + green_offset);
+    // TODO: Maybe it's more appropriate to do this in the platform layer
+    memory.is_initialized = true;
+  }
+
+  ASSERT(sizeof(TransientState) <= memory.transient_storage_size);
+  TransientState *transient_state = (TransientState *)memory.transient_storage;
+  if (!transient_state->is_initialized) {
+    initialize_arena(&transient_state->transient_arena,
+                     memory.transient_storage_size - sizeof(TransientState),
+                     (uint8_t *)memory.transient_storage +
+                         sizeof(TransientState));
 
-      *pixel++ = (uint32_t)((green << 8) | blue);
+    initialize_assets(&transient_state->assets, memory,
+                      &transient_state->transient_arena, MEGABYTES(64),
+                      "handmade.hha");
+    // NOTE: Everything is small enough to just start loading it all now
+    for (uint32_t asset_index = 0; asset_index < ASSET_COUNT; ++asset_index) {
+      load_asset(&transient_state->assets, (AssetId)asset_index);
     }
 
-    row += buffer.pitch;
+    transient_state->is_initialized = true;
   }
 }
 
-void game_update_and_render(GameInput *input,
-                            const GameOffscreenBuffer &buffer,
-                            const GameSoundOutputBuffer &sound_buffer,
-                            GameMemory &memory) {
-  ASSERT(sizeof(GameState) <= memory.permanent_storage_size);
-  GameState *game_state = (GameState *)memory.permanent_storage;
-  if (!memory.is_initialized) {
-    const char *filename = __FILE__;
-    DEBUGReadFileResult file = DEBUG_platform_read_entire_file(filename);
-    if (file.content) {
-      DEBUG_platform_write_entire_file("text.txt", file.content_size,
-                                       file.content);
-      DEBUG_platform_free_file_memory(file);
-    }
+// NOTE: The world alpha of the way from previous to current
+static GameWorld interpolate_world(const GameWorld &previous,
+                                   const GameWorld &current,
+                                   const float alpha) {
+  GameWorld result;
+  result.green_offset =
+      lerp(previous.green_offset, alpha, current.green_offset);
+  result.blue_offset = lerp(previous.blue_offset, alpha, current.blue_offset);
+  result.player_x = lerp(previous.player_x, alpha, current.player_x);
+  result.player_y = lerp(previous.player_y, alpha, current.player_y);
+  // NOTE: The angle wraps around, so it goes the short way
+  float angle_change = current.sprite_angle - previous.sprite_angle;
+  if (angle_change < -0.5f) {
+    angle_change += 1.0f;
+  } else if (angle_change > 0.5f) {
+    angle_change -= 1.0f;
+  }
+  result.sprite_angle = previous.sprite_angle + alpha * angle_change;
 
-    game_state->frequency = 256;
+  return result;
+}
 
-    // TODO: Maybe it's more appropriate to do this in the platform layer
-    memory.is_initialized = true;
-  }
+void game_update(GameInput *input, GameMemory &memory) {
+#if HANDMADE_INTERNAL
+  debug_global_table = memory.debug_table;
+#endif
+  TIMED_FUNCTION();
+  initialize_game(memory);
+  GameState *game_state = (GameState *)memory.permanent_storage;
+  TransientState *transient_state = (TransientState *)memory.transient_storage;
+  GameWorld &world = game_state->world;
+  game_state->previous_world = world;
 
+  constexpr float dt = GAME_UPDATE_SECONDS;
   for (size_t i = 0; i < input->controllers.size(); ++i) {
     const GameControllerInput *controller = get_controller(input, i);
+    if (was_pressed(controller->right_shoulder)) {
+      game_state->is_paused = !game_state->is_paused;
+      if (game_state->is_paused) {
+        stop_sound(&game_state->audio_state, game_state->tone_sound);
+        game_state->tone_sound = INVALID_PLAYING_SOUND;
+      } else {
+        game_state->tone_sound =
+            play_tone(&game_state->audio_state, (float)game_state->frequency,
+                      3000.0f / 32767.0f, 0.0f);
+      }
+    }
+    if (game_state->is_paused) {
+      continue;
+    }
+
     if (controller->is_analog) {
-      game_state->blue_offset += (int)(4.0f * controller->stick_average_x);
+      world.blue_offset += PLAYER_SPEED * controller->stick_average_x * dt;
       game_state->frequency = 256 + (int)(128.0f * controller->stick_average_y);
+      world.player_x += PLAYER_SPEED * controller->stick_average_x * dt;
+      world.player_y += PLAYER_SPEED * controller->stick_average_y * dt;
     } else {
       if (controller->move_left.ended_down) {
-        game_state->blue_offset -= 1;
+        world.blue_offset -= GRADIENT_SPEED * dt;
+        world.player_x -= PLAYER_SPEED * dt;
       } else if (controller->move_right.ended_down) {
-        game_state->blue_offset += 1;
+        world.blue_offset += GRADIENT_SPEED * dt;
+        world.player_x += PLAYER_SPEED * dt;
+      }
+      if (controller->move_up.ended_down) {
+        world.player_y -= PLAYER_SPEED * dt;
+      } else if (controller->move_down.ended_down) {
+        world.player_y += PLAYER_SPEED * dt;
       }
     }
 
     if (controller->action_down.ended_down) {
-      game_state->green_offset += 1;
+      world.green_offset += GRADIENT_SPEED * dt;
+    }
+    if (was_pressed(controller->action_up)) {
+      const LoadedSound *bloop_sound =
+          get_sound(&transient_state->assets, AssetId::BloopSound);
+      if (bloop_sound) {
+        play_sound(&game_state->audio_state, bloop_sound, 0.5f, 0.0f);
+      }
     }
   }
 
-  game_output_sound(sound_buffer, game_state->frequency);
-  render_weird_gradient(buffer, game_state->blue_offset,
-                        game_state->green_offset);
+  if (!game_state->is_paused) {
+    world.sprite_angle += SPRITE_TURNS_PER_SECOND * dt;
+    if (world.sprite_angle >= 1.0f) {
+      world.sprite_angle -= 1.0f;
+    }
+  }
+
+  if (game_state->music_stream.info.is_valid) {
+    fill_audio_stream(memory, &game_state->music_stream);
+  }
+}
+
+void game_render(const GameOffscreenBuffer &buffer, GameMemory &memory,
+                 const float alpha) {
+#if HANDMADE_INTERNAL
+  debug_global_table = memory.debug_table;
+#endif
+  TIMED_FUNCTION();
+  // NOTE: Not part of GameMemory, so the kernels are picked again whenever the
+  // game code is (re)loaded
+  if (!global_render_kernels.render_weird_gradient) {
+    init_render_kernels();
+  }
+  initialize_game(memory);
+  GameState *game_state = (GameState *)memory.permanent_storage;
+  TransientState *transient_state = (TransientState *)memory.transient_storage;
+  const GameWorld world =
+      interpolate_world(game_state->previous_world, game_state->world, alpha);
+  const int32_t player_x = (int32_t)lroundf(world.player_x);
+  const int32_t player_y = (int32_t)lroundf(world.player_y);
+
+  // NOTE: The tone follows the player around the stereo field
+  if (game_state->tone_sound != INVALID_PLAYING_SOUND) {
+    const float pan = 2.0f * world.player_x / (float)buffer.width - 1.0f;
+    change_frequency(&game_state->audio_state, game_state->tone_sound,
+                     (float)game_state->frequency);
+    change_volume(&game_state->audio_state, game_state->tone_sound,
+                  3000.0f / 32767.0f, std::clamp(pan, -1.0f, 1.0f));
+  }
+
+  // NOTE: Everything in here is per-frame scratch
+  TemporaryMemory render_memory =
+      begin_temporary_memory(&transient_state->transient_arena);
+
+  RenderGroup *render_group =
+      allocate_render_group(&transient_state->transient_arena, MEGABYTES(4));
+  if (game_state->is_paused) {
+    const int32_t width = (int32_t)buffer.width;
+    const int32_t height = (int32_t)buffer.height;
+    push_clear(render_group, 0, 0xFF202020);
+    push_rectangle(render_group, 1,
+                   Rectangle2i{width / 4, height / 4, 3 * width / 4,
+                               3 * height / 4},
+                   0xFF404060);
+  } else {
+    push_weird_gradient(render_group, 0, (int32_t)world.blue_offset,
+                        (int32_t)world.green_offset);
+    const LoadedBitmap *player_bitmap =
+        get_bitmap(&transient_state->assets, AssetId::PlayerBitmap);
+    if (player_bitmap) {
+      // NOTE: Drop shadow
+      push_rectangle(
+          render_group, 1,
+          Rectangle2i{player_x + 4, player_y + 4,
+                      player_x + 4 + (int32_t)player_bitmap->width,
+                      player_y + 4 + (int32_t)player_bitmap->height},
+          0xFF000000);
+      push_bitmap(render_group, 2, player_bitmap, player_x, player_y);
+
+      // NOTE: The same bitmap spinning and breathing in the middle of the
+      // screen
+      const float angle = 2.0f * PI_32 * world.sprite_angle;
+      const float scale = 6.0f + 2.0f * std::sin(2.0f * angle);
+      const float x_axis_x = scale * (float)player_bitmap->width *
+                             std::cos(angle);
+      const float x_axis_y = scale * (float)player_bitmap->width *
+                             std::sin(angle);
+      const float y_axis_x = -scale * (float)player_bitmap->height *
+                             std::sin(angle);
+      const float y_axis_y = scale * (float)player_bitmap->height *
+                             std::cos(angle);
+      push_textured_quad(
+          render_group, 1, player_bitmap,
+          0.5f * ((float)buffer.width - x_axis_x - y_axis_x),
+          0.5f * ((float)buffer.height - x_axis_y - y_axis_y), x_axis_x,
+          x_axis_y, y_axis_x, y_axis_y);
+    } else {
+      // NOTE: Stand-in until the bitmap has loaded
+      push_rectangle(render_group, 2,
+                     Rectangle2i{player_x, player_y,
+                                 player_x + (int32_t)PLAYER_BITMAP_DIM,
+                                 player_y + (int32_t)PLAYER_BITMAP_DIM},
+                     0xFFFFCC00);
+    }
+  }
+  tiled_render_group_to_output(memory, render_group, buffer,
+                               &transient_state->tile_cache);
+
+  end_temporary_memory(render_memory);
+  check_arena(&game_state->world_arena);
+  check_arena(&transient_state->transient_arena);
+
+  memory.usage.permanent_used =
+      sizeof(GameState) + game_state->world_arena.used;
+  memory.usage.transient_used =
+      sizeof(TransientState) + transient_state->transient_arena.used;
+  memory.usage.transient_high_water_mark =
+      sizeof(TransientState) +
+      transient_state->transient_arena.high_water_mark;
+}
+
+void game_get_sound_samples(GameMemory &memory,
+                            const GameSoundOutputBuffer &sound_buffer) {
+  TIMED_BLOCK(__func__, sound_buffer.sample_count);
+  GameState *game_state = (GameState *)memory.permanent_storage;
+  if (!memory.is_initialized) {
+    memset(sound_buffer.samples, 0,
+           sound_buffer.sample_count * 2 * sizeof(int16_t));
+    return;
+  }
+
+  output_playing_sounds(&game_state->audio_state, sound_buffer);
 }
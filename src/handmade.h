@@ -16,7 +16,7 @@ constexpr void ASSERT(bool expression) {
   }
 }
 #else
-constexpr void ASSERT(bool expresion) {}
+constexpr void ASSERT([[maybe_unused]] bool expression) {}
 #endif
 
 constexpr uint64_t KILOBYTES(const uint64_t value) { return value * 1024; }
@@ -30,6 +30,8 @@ constexpr uint64_t TERABYTES(const uint64_t value) {
   return GIGABYTES(value) * 1024;
 }
 
+constexpr float PI_32 = 3.14159265359f;
+
 static inline uint32_t SAFE_TRUNCATE_U64(uint64_t value) {
   ASSERT(value <= 0xffffffff);
   uint32_t result = (uint32_t)value;
@@ -41,18 +43,52 @@ static inline uint32_t SAFE_TRUNCATE_U64(uint64_t value) {
  */
 
 #if HANDMADE_INTERNAL
-struct DEBUGReadFileResult {
-  uint32_t content_size;
-  void *content;
-};
-static DEBUGReadFileResult
-DEBUG_platform_read_entire_file(const char *filename);
-static bool DEBUG_platform_write_entire_file(const char *filename,
-                                             uint32_t size, void *content);
-static void
-DEBUG_platform_free_file_memory(DEBUGReadFileResult &read_file_result);
+typedef bool DebugPlatformWriteEntireFile(const char *filename,
+                                          uint64_t size,
+                                          const void *content);
 #endif
 
+/*
+ * NOTE: Read-only file access for assets. Opening a file maps all of it, so
+ * `content` can be used in place without copying anything, and ranged reads
+ * are a bounds-checked copy out of the mapping. A handle that failed to open,
+ * or on which any read failed, has no_errors cleared; reads on such a handle
+ * fill the destination with zeros, so callers only need to check once at the
+ * end. The platform logs what went wrong.
+ */
+enum class PlatformFileUsage : uint32_t {
+  // NOTE: The whole file is about to be used, start reading it in now
+  WholeFile,
+  // NOTE: Read front to back a bit at a time, read ahead aggressively and
+  // drop pages once they've been read
+  Streamed,
+};
+
+struct PlatformFileHandle {
+  bool no_errors;
+  uint64_t size;
+  // NOTE: Valid until the handle is closed, NULL for empty files
+  const void *content;
+};
+typedef PlatformFileHandle PlatformOpenFile(const char *filename,
+                                            PlatformFileUsage usage);
+typedef void PlatformReadDataFromFile(PlatformFileHandle *handle,
+                                      uint64_t offset, uint64_t size,
+                                      void *dest);
+typedef void PlatformCloseFile(PlatformFileHandle *handle);
+
+/*
+ * NOTE: Work queue owned by the platform. Entries are run by the platform's
+ * worker threads and can be added from any thread; complete_all_work also
+ * works on the queue from the calling thread until everything that was added
+ * has finished.
+ */
+struct PlatformWorkQueue;
+typedef void PlatformWorkQueueCallback(PlatformWorkQueue *queue, void *data);
+typedef void PlatformAddEntry(PlatformWorkQueue *queue,
+                              PlatformWorkQueueCallback *callback, void *data);
+typedef void PlatformCompleteAllWork(PlatformWorkQueue *queue);
+
 /*
  * NOTE: Code made available by the game layer to the platform layer
  */
@@ -108,21 +144,151 @@ static inline GameControllerInput *get_controller(GameInput *input,
   return &input->controllers[controller_index];
 }
 
+#if HANDMADE_INTERNAL
+// NOTE: See handmade_debug.h
+struct DebugTable;
+#endif
+
+/*
+ * NOTE: Filled in by the game every frame so the platform can report how much
+ * of each block is actually in use
+ */
+struct GameMemoryUsage {
+  uint64_t permanent_used;
+  uint64_t transient_used;
+  uint64_t transient_high_water_mark;
+};
+
+/*
+ * NOTE: Filled in by the game every frame with the parts of the backbuffer it
+ * drew to. Pixels outside of them are the same as in the previous frame, so
+ * the platform only has to present these.
+ */
+constexpr uint32_t MAX_DIRTY_RECT_COUNT = 1024;
+
+struct GameDirtyRect {
+  uint32_t min_x;
+  uint32_t min_y;
+  uint32_t max_x;
+  uint32_t max_y;
+};
+
+struct GameDirtyRects {
+  uint32_t count;
+  std::array<GameDirtyRect, MAX_DIRTY_RECT_COUNT> rects;
+};
+
 struct GameMemory {
   bool is_initialized;
   uint64_t permanent_storage_size;
   void *permanent_storage; // NOTE: This is REQUIRED to be initialized to zero
   uint64_t transient_storage_size;
   void *transient_storage; // NOTE: This is REQUIRED to be initialized to zero
+
+  // NOTE: Both queues share the platform's workers, which take high priority
+  // entries first. High priority is for work the frame waits on, like render
+  // tiles. May be NULL, in which case the game renders on the calling thread.
+  PlatformWorkQueue *high_priority_queue;
+  // NOTE: For work that may take several frames, like asset loads. May be
+  // NULL, in which case assets load on the calling thread.
+  PlatformWorkQueue *low_priority_queue;
+  PlatformAddEntry *platform_add_entry;
+  PlatformCompleteAllWork *platform_complete_all_work;
+
+  PlatformOpenFile *platform_open_file;
+  PlatformReadDataFromFile *platform_read_data_from_file;
+  PlatformCloseFile *platform_close_file;
+
+  GameMemoryUsage usage;
+  // NOTE: The platform sets backbuffer_lost for frames where the backbuffer
+  // doesn't hold the previous frame anymore (e.g. it was reallocated), the
+  // game then redraws all of it
+  bool backbuffer_lost;
+  GameDirtyRects dirty_rects;
+
+#if HANDMADE_INTERNAL
+  DebugPlatformWriteEntireFile *DEBUG_platform_write_entire_file;
+  // NOTE: May be NULL, in which case timed blocks record nothing
+  DebugTable *debug_table;
+#endif
 };
 
-void game_update_and_render(const GameInput &input,
-                            const GameOffscreenBuffer &buffer,
-                            const GameSoundOutputBuffer &sound_buffer);
+/*
+ * NOTE: The simulation always advances in steps of GAME_UPDATE_SECONDS,
+ * however often the platform renders
+ */
+constexpr uint32_t GAME_UPDATE_HZ = 60;
+constexpr float GAME_UPDATE_SECONDS = 1.0f / (float)GAME_UPDATE_HZ;
+
+/*
+ * NOTE: The X11 platform loads the game as a shared library and looks these
+ * up by name, so they have C linkage. Everything the game keeps between
+ * calls has to live in GameMemory, the library may be swapped for a rebuilt
+ * one between any two frames.
+ *
+ * Every frame the platform calls game_update as many times as it takes for
+ * the simulation to keep up with real time, which may be none, then
+ * game_render once. A button's transitions are only in the input of the
+ * first update that sees them.
+ */
+typedef void GameUpdate(GameInput *input, GameMemory &memory);
+// NOTE: alpha is how far, from 0 to 1, real time is past the last update
+// towards the next one. The game draws its state that far between the last
+// two updates.
+typedef void GameRender(const GameOffscreenBuffer &buffer, GameMemory &memory,
+                        float alpha);
+// NOTE: May be called several times per frame (e.g. when the platform's ring
+// buffer wraps), each call continues where the previous one stopped
+typedef void GameGetSoundSamples(GameMemory &memory,
+                                 const GameSoundOutputBuffer &sound_buffer);
+extern "C" GameUpdate game_update;
+extern "C" GameRender game_render;
+extern "C" GameGetSoundSamples game_get_sound_samples;
+
+#include "handmade_audio.h"
+#include "handmade_debug.h"
+#include "handmade_memory.h"
+#include "handmade_render_group.h"
+#include "handmade_asset.h"
+
+constexpr uint32_t PLAYER_BITMAP_DIM = 32;
+// NOTE: In pixels per second
+constexpr float PLAYER_SPEED = 120.0f;
+constexpr float GRADIENT_SPEED = 30.0f;
+constexpr float SPRITE_TURNS_PER_SECOND = 1.0f / 12.0f;
+
+// NOTE: Everything the simulation moves, which frames draw between updates
+struct GameWorld {
+  float green_offset;
+  float blue_offset;
+  float player_x;
+  float player_y;
+  // NOTE: In turns, the spinning sprite's rotation
+  float sprite_angle;
+};
 
 // TODO: Don't know where to put it yet
+// NOTE: Lives at the start of permanent storage
 struct GameState {
-  int32_t green_offset;
-  int32_t blue_offset;
+  MemoryArena world_arena;
+
   int32_t frequency;
+
+  AudioState audio_state;
+  uint32_t tone_sound;
+  // NOTE: Not open when the file isn't there
+  AudioStream music_stream;
+
+  bool is_paused;
+  GameWorld world;
+  // NOTE: As it was before the last update
+  GameWorld previous_world;
+};
+
+// NOTE: Lives at the start of transient storage
+struct TransientState {
+  bool is_initialized;
+  MemoryArena transient_arena;
+  Assets assets;
+  RenderTileCache tile_cache;
 };
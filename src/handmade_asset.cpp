@@ -0,0 +1,159 @@
+#include "handmade_asset.h"
+
+/*
+ * NOTE: Opens the pack and reads its table of contents. If the pack is
+ * missing or out of date every asset just fails to load.
+ */
+static void initialize_assets(Assets *assets, GameMemory &memory,
+                              MemoryArena *arena, const uint64_t size,
+                              const char *pack_filename) {
+  sub_arena(&assets->arena, arena, size);
+  assets->queue = memory.low_priority_queue;
+  assets->platform_add_entry = memory.platform_add_entry;
+  assets->platform_read_data_from_file = memory.platform_read_data_from_file;
+
+  assets->pack =
+      memory.platform_open_file(pack_filename, PlatformFileUsage::WholeFile);
+  AssetPackHeader header;
+  memory.platform_read_data_from_file(&assets->pack, 0, sizeof(header),
+                                      &header);
+  const bool is_current_pack = header.magic == ASSET_PACK_MAGIC &&
+                               header.version == ASSET_PACK_VERSION &&
+                               header.asset_count == ASSET_COUNT;
+  if (is_current_pack) {
+    memory.platform_read_data_from_file(
+        &assets->pack, header.assets_offset,
+        ASSET_COUNT * sizeof(PackedAsset), assets->packed_assets.data());
+  }
+  if (!is_current_pack || !assets->pack.no_errors) {
+    // TODO: Log
+    memory.platform_close_file(&assets->pack);
+    for (PackedAsset &packed_asset : assets->packed_assets) {
+      packed_asset = {};
+    }
+  }
+
+  for (uint32_t asset_index = 0; asset_index < ASSET_COUNT; ++asset_index) {
+    assets->load_work[asset_index] = {assets, (AssetId)asset_index};
+    assets->slots[asset_index].state.store(
+        assets->packed_assets[asset_index].type == PackedAssetType::Missing
+            ? AssetState::Failed
+            : AssetState::Unloaded,
+        std::memory_order_relaxed);
+  }
+}
+
+// NOTE: Runs on the asset queue
+static void do_load_asset_work(PlatformWorkQueue *, void *data) {
+  TIMED_FUNCTION();
+  const LoadAssetWork *work = (const LoadAssetWork *)data;
+  Assets *assets = work->assets;
+  const PackedAsset &packed_asset =
+      assets->packed_assets[(uint32_t)work->id];
+  AssetSlot &slot = assets->slots[(uint32_t)work->id];
+
+  // NOTE: A copy, so a failed read doesn't flag the handle every other load
+  // goes through
+  PlatformFileHandle pack = assets->pack;
+  assets->platform_read_data_from_file(&pack, packed_asset.data_offset,
+                                       packed_asset.data_size, slot.memory);
+
+  slot.state.store(pack.no_errors ? AssetState::Loaded : AssetState::Failed,
+                   std::memory_order_release);
+}
+
+static uint64_t get_expected_asset_size(const PackedAsset &packed_asset) {
+  uint64_t result = 0;
+  switch (packed_asset.type) {
+  case PackedAssetType::Missing: {
+  } break;
+  case PackedAssetType::Bitmap: {
+    result = (uint64_t)packed_asset.bitmap.width * packed_asset.bitmap.height *
+             sizeof(uint32_t);
+  } break;
+  case PackedAssetType::Sound: {
+    result = (uint64_t)packed_asset.sound.sample_count *
+             packed_asset.sound.channel_count * sizeof(int16_t);
+  } break;
+  }
+  return result;
+}
+
+/*
+ * NOTE: Only the game thread moves a slot out of Unloaded, so this needs no
+ * synchronization beyond the queue's own
+ */
+static void load_asset(Assets *assets, const AssetId id) {
+  AssetSlot &slot = assets->slots[(uint32_t)id];
+  if (slot.state.load(std::memory_order_relaxed) != AssetState::Unloaded) {
+    return;
+  }
+
+  const PackedAsset &packed_asset = assets->packed_assets[(uint32_t)id];
+  const uint64_t size = packed_asset.data_size;
+  if (size == 0 || size != get_expected_asset_size(packed_asset) ||
+      assets->arena.used + size + 16 > assets->arena.size) {
+    // TODO: Log. Evict something once assets don't all fit.
+    slot.state.store(AssetState::Failed, std::memory_order_relaxed);
+    return;
+  }
+
+  slot.memory = push_size(&assets->arena, size, 16);
+  switch (packed_asset.type) {
+  case PackedAssetType::Missing: {
+    ASSERT(!"Missing assets are never loaded");
+  } break;
+  case PackedAssetType::Bitmap: {
+    slot.bitmap.width = packed_asset.bitmap.width;
+    slot.bitmap.height = packed_asset.bitmap.height;
+    slot.bitmap.pitch = packed_asset.bitmap.width * sizeof(uint32_t);
+    slot.bitmap.memory = (uint32_t *)slot.memory;
+  } break;
+  case PackedAssetType::Sound: {
+    slot.sound.channel_count = packed_asset.sound.channel_count;
+    slot.sound.samples_per_second = packed_asset.sound.samples_per_second;
+    slot.sound.sample_count = packed_asset.sound.sample_count;
+    slot.sound.samples = (const int16_t *)slot.memory;
+  } break;
+  }
+
+  slot.state.store(AssetState::Queued, std::memory_order_relaxed);
+  LoadAssetWork *work = &assets->load_work[(uint32_t)id];
+  if (assets->queue) {
+    assets->platform_add_entry(assets->queue, do_load_asset_work, work);
+  } else {
+    do_load_asset_work(NULL, work);
+  }
+}
+
+// NOTE: NULL until the bitmap is loaded, asking for it starts the load
+static const LoadedBitmap *get_bitmap(Assets *assets, const AssetId id) {
+  ASSERT(assets->packed_assets[(uint32_t)id].type != PackedAssetType::Sound);
+
+  const LoadedBitmap *result = NULL;
+  AssetSlot &slot = assets->slots[(uint32_t)id];
+  const AssetState state = slot.state.load(std::memory_order_acquire);
+  if (state == AssetState::Loaded) {
+    result = &slot.bitmap;
+  } else if (state == AssetState::Unloaded) {
+    load_asset(assets, id);
+  }
+
+  return result;
+}
+
+// NOTE: NULL until the sound is loaded, asking for it starts the load
+static const LoadedSound *get_sound(Assets *assets, const AssetId id) {
+  ASSERT(assets->packed_assets[(uint32_t)id].type != PackedAssetType::Bitmap);
+
+  const LoadedSound *result = NULL;
+  AssetSlot &slot = assets->slots[(uint32_t)id];
+  const AssetState state = slot.state.load(std::memory_order_acquire);
+  if (state == AssetState::Loaded) {
+    result = &slot.sound;
+  } else if (state == AssetState::Unloaded) {
+    load_asset(assets, id);
+  }
+
+  return result;
+}
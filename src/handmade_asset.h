@@ -0,0 +1,50 @@
+#pragma once
+
+#include "handmade.h"
+#include "handmade_file_formats.h"
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * NOTE: Assets come from the asset pack and are loaded on demand. Asking for
+ * one that isn't loaded yet queues a load on the platform's asset queue and
+ * returns NULL; the game draws or plays without it until a later frame finds
+ * it loaded. Loaded assets live in slots in transient storage.
+ */
+
+enum class AssetState : uint32_t {
+  Unloaded,
+  Queued,
+  Loaded,
+  // NOTE: Not in the pack, or reading it failed. Never retried.
+  Failed,
+};
+
+struct AssetSlot {
+  std::atomic<AssetState> state;
+  void *memory;
+  union {
+    LoadedBitmap bitmap;
+    LoadedSound sound;
+  };
+};
+
+struct Assets;
+struct LoadAssetWork {
+  Assets *assets;
+  AssetId id;
+};
+
+struct Assets {
+  MemoryArena arena;
+
+  PlatformWorkQueue *queue;
+  PlatformAddEntry *platform_add_entry;
+  PlatformReadDataFromFile *platform_read_data_from_file;
+
+  PlatformFileHandle pack;
+  std::array<PackedAsset, ASSET_COUNT> packed_assets;
+  std::array<AssetSlot, ASSET_COUNT> slots;
+  std::array<LoadAssetWork, ASSET_COUNT> load_work;
+};
@@ -0,0 +1,399 @@
+#include "handmade_audio.h"
+
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+// NOTE: Small enough for both accumulators to stay in L1
+constexpr uint32_t MIX_CHUNK_SAMPLE_COUNT = 256;
+
+static void initialize_audio_state(AudioState *audio_state,
+                                   const float master_volume) {
+  audio_state->master_volume = master_volume;
+  for (PlayingSound &sound : audio_state->playing_sounds) {
+    sound = {};
+  }
+}
+
+/*
+ * NOTE: Equal power pan, -1 is hard left and 1 hard right
+ */
+static void change_volume(AudioState *audio_state, const uint32_t sound_index,
+                          const float volume, const float pan) {
+  ASSERT(sound_index < MAX_PLAYING_SOUND_COUNT);
+  ASSERT(pan >= -1.0f && pan <= 1.0f);
+
+  PlayingSound &sound = audio_state->playing_sounds[sound_index];
+  const float angle = (pan + 1.0f) * 0.25f * PI_32;
+  sound.left_volume = volume * cosf(angle);
+  sound.right_volume = volume * sinf(angle);
+}
+
+static void change_frequency(AudioState *audio_state,
+                             const uint32_t sound_index,
+                             const float frequency) {
+  ASSERT(sound_index < MAX_PLAYING_SOUND_COUNT);
+  audio_state->playing_sounds[sound_index].frequency = frequency;
+}
+
+static uint32_t allocate_playing_sound(AudioState *audio_state,
+                                       const PlayingSoundType type,
+                                       const float volume, const float pan) {
+  uint32_t result = INVALID_PLAYING_SOUND;
+  for (uint32_t sound_index = 0; sound_index < MAX_PLAYING_SOUND_COUNT;
+       ++sound_index) {
+    PlayingSound &sound = audio_state->playing_sounds[sound_index];
+    if (!sound.is_playing) {
+      sound = {};
+      sound.is_playing = true;
+      sound.type = type;
+      change_volume(audio_state, sound_index, volume, pan);
+      result = sound_index;
+      break;
+    }
+  }
+
+  return result;
+}
+
+static uint32_t play_tone(AudioState *audio_state, const float frequency,
+                          const float volume, const float pan) {
+  const uint32_t result = allocate_playing_sound(
+      audio_state, PlayingSoundType::Tone, volume, pan);
+  if (result != INVALID_PLAYING_SOUND) {
+    change_frequency(audio_state, result, frequency);
+  }
+
+  return result;
+}
+
+// NOTE: Plays once, the voice is freed when the sound ends
+static uint32_t play_sound(AudioState *audio_state, const LoadedSound *sound,
+                           const float volume, const float pan) {
+  const uint32_t result = allocate_playing_sound(
+      audio_state, PlayingSoundType::Sound, volume, pan);
+  if (result != INVALID_PLAYING_SOUND) {
+    audio_state->playing_sounds[result].sound = sound;
+  }
+
+  return result;
+}
+
+// NOTE: Plays from wherever the stream has been consumed up to
+static uint32_t play_stream(AudioState *audio_state, AudioStream *stream,
+                            const float volume, const float pan) {
+  const uint32_t result = allocate_playing_sound(
+      audio_state, PlayingSoundType::Stream, volume, pan);
+  if (result != INVALID_PLAYING_SOUND) {
+    PlayingSound &playing_sound = audio_state->playing_sounds[result];
+    playing_sound.stream = stream;
+    playing_sound.position = stream->consumed_frame << 32;
+  }
+
+  return result;
+}
+
+// NOTE: Stopping INVALID_PLAYING_SOUND is allowed and does nothing
+static void stop_sound(AudioState *audio_state, const uint32_t sound_index) {
+  if (sound_index < MAX_PLAYING_SOUND_COUNT) {
+    audio_state->playing_sounds[sound_index].is_playing = false;
+  }
+}
+
+/*
+ * NOTE: sin(2 * pi * x) for 4 phases in 0.32 fixed point turns. Read as
+ * signed, the phase is x in [-0.5, 0.5), which is folded into [-0.25, 0.25]
+ * (sin is symmetric around a quarter turn) and fed to an odd degree 9 Taylor
+ * polynomial. The error is below 4e-6, under half an int16_t step.
+ */
+static inline __m128 sine_turns_4x(const __m128i phase) {
+  const __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(phase),
+                              _mm_set1_ps(1.0f / 4294967296.0f));
+
+  const __m128 sign_mask = _mm_set1_ps(-0.0f);
+  const __m128 sign = _mm_and_ps(x, sign_mask);
+  const __m128 abs_x = _mm_andnot_ps(sign_mask, x);
+  const __m128 folded = _mm_sub_ps(_mm_or_ps(_mm_set1_ps(0.5f), sign), x);
+  const __m128 fold_mask = _mm_cmpgt_ps(abs_x, _mm_set1_ps(0.25f));
+  const __m128 t = _mm_or_ps(_mm_and_ps(fold_mask, folded),
+                             _mm_andnot_ps(fold_mask, x));
+
+  const __m128 t2 = _mm_mul_ps(t, t);
+  __m128 result = _mm_set1_ps(42.058693944897655f);
+  result =
+      _mm_add_ps(_mm_mul_ps(result, t2), _mm_set1_ps(-76.70585975306136f));
+  result =
+      _mm_add_ps(_mm_mul_ps(result, t2), _mm_set1_ps(81.60524927607504f));
+  result =
+      _mm_add_ps(_mm_mul_ps(result, t2), _mm_set1_ps(-41.34170224039976f));
+  result =
+      _mm_add_ps(_mm_mul_ps(result, t2), _mm_set1_ps(6.283185307179586f));
+  result = _mm_mul_ps(result, t);
+
+  return result;
+}
+
+/*
+ * NOTE: Adds `sound` to the accumulators, `sample_count` rounded up to a
+ * multiple of 4 (the accumulators are padded for it). Only `sample_count`
+ * samples are consumed from the sound's phase.
+ */
+static void mix_tone(PlayingSound &sound, const uint32_t samples_per_second,
+                     const uint32_t sample_count, float *left, float *right) {
+  const uint32_t phase_step = (uint32_t)(
+      (double)sound.frequency / (double)samples_per_second * 4294967296.0);
+
+  __m128i phase = _mm_add_epi32(
+      _mm_set1_epi32((int32_t)sound.phase),
+      _mm_setr_epi32(0, (int32_t)phase_step, (int32_t)(2 * phase_step),
+                     (int32_t)(3 * phase_step)));
+  const __m128i phase_step_4x = _mm_set1_epi32((int32_t)(4 * phase_step));
+  const __m128 left_volume = _mm_set1_ps(sound.left_volume);
+  const __m128 right_volume = _mm_set1_ps(sound.right_volume);
+
+  for (uint32_t i = 0; i < sample_count; i += 4) {
+    const __m128 value = sine_turns_4x(phase);
+    _mm_store_ps(left + i, _mm_add_ps(_mm_load_ps(left + i),
+                                      _mm_mul_ps(value, left_volume)));
+    _mm_store_ps(right + i, _mm_add_ps(_mm_load_ps(right + i),
+                                       _mm_mul_ps(value, right_volume)));
+    phase = _mm_add_epi32(phase, phase_step_4x);
+  }
+
+  sound.phase += sample_count * phase_step;
+}
+
+/*
+ * NOTE: Adds `sound` to the accumulators, linearly resampling `source` to
+ * `samples_per_second`. Returns how many samples were mixed, fewer than
+ * `sample_count` when the source ran out of frames.
+ */
+static uint32_t mix_samples(PlayingSound &sound, const SampleSource &source,
+                            const uint32_t samples_per_second,
+                            const uint32_t sample_count, float *left,
+                            float *right) {
+  const uint64_t step =
+      ((uint64_t)source.samples_per_second << 32) / samples_per_second;
+  const float left_volume = sound.left_volume * (1.0f / 32768.0f);
+  const float right_volume = sound.right_volume * (1.0f / 32768.0f);
+  const uint32_t right_channel = source.channel_count - 1;
+
+  uint32_t result = 0;
+  for (; result < sample_count; ++result) {
+    const uint64_t frame = sound.position >> 32;
+    if (frame + 1 >= source.end_frame) {
+      break;
+    }
+
+    const float t = (float)(uint32_t)sound.position * (1.0f / 4294967296.0f);
+    const int16_t *a =
+        source.samples + (frame & source.frame_mask) * source.channel_count;
+    const int16_t *b = source.samples + ((frame + 1) & source.frame_mask) *
+                                            source.channel_count;
+    const float l = (float)a[0] + t * (float)(b[0] - a[0]);
+    const float r = (float)a[right_channel] +
+                    t * (float)(b[right_channel] - a[right_channel]);
+    left[result] += l * left_volume;
+    right[result] += r * right_volume;
+
+    sound.position += step;
+  }
+
+  return result;
+}
+
+/*
+ * NOTE: Interleaves the accumulators, scales them to int16_t and packs with
+ * signed saturation, so loud mixes clip instead of wrapping around
+ */
+static void output_mix_chunk(const float *left, const float *right,
+                             const float master_volume,
+                             const uint32_t sample_count, int16_t *output) {
+  const __m128 scale = _mm_set1_ps(master_volume * 32767.0f);
+  const uint32_t wide_sample_count = sample_count & ~3u;
+
+  for (uint32_t i = 0; i < wide_sample_count; i += 4) {
+    const __m128 l = _mm_mul_ps(_mm_load_ps(left + i), scale);
+    const __m128 r = _mm_mul_ps(_mm_load_ps(right + i), scale);
+    const __m128i low = _mm_cvtps_epi32(_mm_unpacklo_ps(l, r));
+    const __m128i high = _mm_cvtps_epi32(_mm_unpackhi_ps(l, r));
+    _mm_storeu_si128((__m128i *)(output + 2 * i), _mm_packs_epi32(low, high));
+  }
+
+  if (wide_sample_count < sample_count) {
+    alignas(16) std::array<int16_t, 8> tail;
+    const __m128 l = _mm_mul_ps(_mm_load_ps(left + wide_sample_count), scale);
+    const __m128 r = _mm_mul_ps(_mm_load_ps(right + wide_sample_count), scale);
+    const __m128i low = _mm_cvtps_epi32(_mm_unpacklo_ps(l, r));
+    const __m128i high = _mm_cvtps_epi32(_mm_unpackhi_ps(l, r));
+    _mm_store_si128((__m128i *)tail.data(), _mm_packs_epi32(low, high));
+    memcpy(output + 2 * wide_sample_count, tail.data(),
+           2 * (sample_count - wide_sample_count) * sizeof(int16_t));
+  }
+}
+
+static void output_playing_sounds(AudioState *audio_state,
+                                  const GameSoundOutputBuffer &sound_buffer) {
+  alignas(16) std::array<float, MIX_CHUNK_SAMPLE_COUNT> left;
+  alignas(16) std::array<float, MIX_CHUNK_SAMPLE_COUNT> right;
+
+  int16_t *output = sound_buffer.samples;
+  uint32_t samples_remaining = sound_buffer.sample_count;
+  while (samples_remaining > 0) {
+    const uint32_t chunk_sample_count =
+        std::min(samples_remaining, MIX_CHUNK_SAMPLE_COUNT);
+    left.fill(0.0f);
+    right.fill(0.0f);
+
+    for (PlayingSound &sound : audio_state->playing_sounds) {
+      if (!sound.is_playing) {
+        continue;
+      }
+
+      switch (sound.type) {
+      case PlayingSoundType::Tone: {
+        mix_tone(sound, sound_buffer.samples_per_second, chunk_sample_count,
+                 left.data(), right.data());
+      } break;
+      case PlayingSoundType::Sound: {
+        const SampleSource source{
+            sound.sound->samples, sound.sound->channel_count,
+            sound.sound->samples_per_second, ~0ull, sound.sound->sample_count};
+        if (mix_samples(sound, source, sound_buffer.samples_per_second,
+                        chunk_sample_count, left.data(),
+                        right.data()) < chunk_sample_count) {
+          sound.is_playing = false;
+        }
+      } break;
+      case PlayingSoundType::Stream: {
+        // NOTE: If the stream wasn't refilled in time the rest of the chunk is
+        // silent for this voice, it picks up again once there's data
+        AudioStream *stream = sound.stream;
+        const SampleSource source{stream->samples, stream->info.channel_count,
+                                  stream->info.samples_per_second,
+                                  AUDIO_STREAM_SAMPLE_COUNT - 1,
+                                  stream->buffered_end};
+        mix_samples(sound, source, sound_buffer.samples_per_second,
+                    chunk_sample_count, left.data(), right.data());
+        stream->consumed_frame = sound.position >> 32;
+      } break;
+      }
+    }
+
+    output_mix_chunk(left.data(), right.data(), audio_state->master_volume,
+                     chunk_sample_count, output);
+    output += 2 * chunk_sample_count;
+    samples_remaining -= chunk_sample_count;
+  }
+}
+
+/*
+ * NOTE: WAV files. Only 16 bit PCM with one or two channels is supported.
+ */
+
+static WavInfo parse_wav(GameMemory &memory, PlatformFileHandle *file) {
+  WavInfo result = {};
+
+  WavHeader header;
+  memory.platform_read_data_from_file(file, 0, sizeof(header), &header);
+  if (!file->no_errors || header.riff_id != riff_code('R', 'I', 'F', 'F') ||
+      header.wave_id != riff_code('W', 'A', 'V', 'E')) {
+    return result;
+  }
+
+  WavFormat format = {};
+  bool has_format = false;
+  bool has_data = false;
+  uint32_t data_size = 0;
+  uint64_t offset = sizeof(header);
+  while (offset + sizeof(WavChunkHeader) <= file->size &&
+         !(has_format && has_data)) {
+    WavChunkHeader chunk;
+    memory.platform_read_data_from_file(file, offset, sizeof(chunk), &chunk);
+    const uint64_t body_offset = offset + sizeof(chunk);
+
+    switch (chunk.id) {
+    case riff_code('f', 'm', 't', ' '): {
+      if (chunk.size >= sizeof(format)) {
+        memory.platform_read_data_from_file(file, body_offset, sizeof(format),
+                                            &format);
+        has_format = true;
+      }
+    } break;
+    case riff_code('d', 'a', 't', 'a'): {
+      result.data_offset = body_offset;
+      data_size = chunk.size;
+      has_data = true;
+    } break;
+    }
+
+    // NOTE: Chunks are padded to an even size
+    offset = body_offset + chunk.size + (chunk.size & 1);
+  }
+
+  if (file->no_errors && has_format && has_data && format.format_tag == 1 &&
+      format.bits_per_sample == 16 &&
+      (format.channel_count == 1 || format.channel_count == 2) &&
+      format.samples_per_second > 0 &&
+      result.data_offset + data_size <= file->size) {
+    result.is_valid = true;
+    result.channel_count = format.channel_count;
+    result.samples_per_second = format.samples_per_second;
+    result.sample_count =
+        data_size / (format.channel_count * (uint32_t)sizeof(int16_t));
+  }
+
+  return result;
+}
+
+/*
+ * NOTE: Tops the stream's ring up, one chunk per read. Called once per frame,
+ * the ring holds a third of a second at 48kHz so a few late frames don't
+ * starve it.
+ */
+static void fill_audio_stream(GameMemory &memory, AudioStream *stream) {
+  TIMED_FUNCTION();
+  const uint32_t channel_count = stream->info.channel_count;
+  const uint64_t frame_size = channel_count * sizeof(int16_t);
+  while (stream->buffered_end + AUDIO_STREAM_CHUNK_SAMPLE_COUNT <=
+         stream->consumed_frame + AUDIO_STREAM_SAMPLE_COUNT) {
+    const uint32_t ring_offset =
+        (uint32_t)(stream->buffered_end & (AUDIO_STREAM_SAMPLE_COUNT - 1));
+    const uint32_t file_frame =
+        (uint32_t)(stream->buffered_end % stream->info.sample_count);
+    const uint32_t frame_count =
+        std::min({AUDIO_STREAM_CHUNK_SAMPLE_COUNT,
+                  AUDIO_STREAM_SAMPLE_COUNT - ring_offset,
+                  stream->info.sample_count - file_frame});
+
+    // NOTE: A failed read leaves zeros, the stream plays silence
+    memory.platform_read_data_from_file(
+        &stream->file, stream->info.data_offset + file_frame * frame_size,
+        frame_count * frame_size,
+        stream->samples + ring_offset * channel_count);
+    stream->buffered_end += frame_count;
+  }
+}
+
+/*
+ * NOTE: For music, only AUDIO_STREAM_SAMPLE_COUNT frames are ever in memory.
+ * The file stays open for as long as the game runs.
+ */
+static bool open_audio_stream(GameMemory &memory, MemoryArena *arena,
+                              AudioStream *stream, const char *filename) {
+  *stream = {};
+  stream->file =
+      memory.platform_open_file(filename, PlatformFileUsage::Streamed);
+  stream->info = parse_wav(memory, &stream->file);
+  if (!stream->info.is_valid || stream->info.sample_count < 2) {
+    memory.platform_close_file(&stream->file);
+    stream->info.is_valid = false;
+    return false;
+  }
+
+  stream->samples = push_array<int16_t>(
+      arena, AUDIO_STREAM_SAMPLE_COUNT * stream->info.channel_count, 16);
+  fill_audio_stream(memory, stream);
+
+  return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "handmade.h"
+#include "handmade_file_formats.h"
+
+#include <cstdint>
+
+/*
+ * NOTE: Software mixer. Every playing sound is a voice with its own phase,
+ * volume and pan. Voices are summed into float accumulators a chunk at a time
+ * and only converted (with saturation) to int16_t at the very end.
+ */
+
+constexpr uint32_t MAX_PLAYING_SOUND_COUNT = 64;
+// NOTE: Returned by play_* when every voice is taken
+constexpr uint32_t INVALID_PLAYING_SOUND = MAX_PLAYING_SOUND_COUNT;
+
+/*
+ * NOTE: 16 bit PCM straight from a WAV file, interleaved when it has two
+ * channels. Played back at whatever rate the platform asks for.
+ */
+struct LoadedSound {
+  uint32_t channel_count;
+  uint32_t samples_per_second;
+  uint32_t sample_count;
+  const int16_t *samples;
+};
+
+/*
+ * NOTE: Where the sample data of a WAV file is, as found by parse_wav
+ */
+struct WavInfo {
+  bool is_valid;
+  uint32_t channel_count;
+  uint32_t samples_per_second;
+  uint64_t data_offset;
+  uint32_t sample_count;
+};
+
+/*
+ * NOTE: A long sound that is read from disk a chunk at a time into a ring of
+ * AUDIO_STREAM_SAMPLE_COUNT sample frames, looping at the end of the file.
+ * Frame indices count from the start of playback and only ever grow, the
+ * frames in [consumed_frame, buffered_end) are in the ring.
+ */
+constexpr uint32_t AUDIO_STREAM_SAMPLE_COUNT = 16384;
+constexpr uint32_t AUDIO_STREAM_CHUNK_SAMPLE_COUNT = 4096;
+
+struct AudioStream {
+  PlatformFileHandle file;
+  WavInfo info;
+  uint64_t consumed_frame;
+  uint64_t buffered_end;
+  int16_t *samples;
+};
+
+/*
+ * NOTE: The frames a Sound or Stream voice reads from. Frame indices are
+ * masked with frame_mask to find them in `samples`, only frames before
+ * end_frame can be read.
+ */
+struct SampleSource {
+  const int16_t *samples;
+  uint32_t channel_count;
+  uint32_t samples_per_second;
+  uint64_t frame_mask;
+  uint64_t end_frame;
+};
+
+enum class PlayingSoundType : uint32_t {
+  Tone,
+  Sound,
+  Stream,
+};
+
+struct PlayingSound {
+  bool is_playing;
+  PlayingSoundType type;
+
+  // NOTE: Tone
+  float frequency;
+  // NOTE: 0.32 fixed point, in turns. Wraps around exactly, so it never
+  // drifts however long the sound plays.
+  uint32_t phase;
+
+  // NOTE: Sound and Stream. Source sample frame in 32.32 fixed point, the
+  // fractional part is what linear resampling interpolates by.
+  const LoadedSound *sound;
+  AudioStream *stream;
+  uint64_t position;
+
+  // NOTE: Per channel gain, volume with the pan already applied
+  float left_volume;
+  float right_volume;
+};
+
+struct AudioState {
+  float master_volume;
+  std::array<PlayingSound, MAX_PLAYING_SOUND_COUNT> playing_sounds;
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <x86intrin.h>
+
+/*
+ * NOTE: rdtsc profiler. Timed blocks record a begin and an end event into a
+ * ring owned by the thread they run on, in the DebugTable the platform hands
+ * the game through GameMemory. Each thread is the only writer of its ring;
+ * the platform reads all of them at the end of every frame to tally the
+ * blocks, and can dump whatever they still hold as a Chrome trace.
+ *
+ * Rings don't wait for the reader, a thread that records more than a ring's
+ * worth of events between two reads overwrites the oldest ones. The reader
+ * checks write_index after copying an event out and drops it if the writer
+ * may have been writing over it meanwhile.
+ */
+
+#if HANDMADE_INTERNAL
+constexpr uint32_t DEBUG_MAX_THREAD_COUNT = 64;
+constexpr uint32_t DEBUG_EVENT_RING_CAPACITY = 8192;
+constexpr uint32_t DEBUG_MAX_BLOCK_DEPTH = 32;
+constexpr uint32_t DEBUG_MAX_BLOCK_STATS_COUNT = 64;
+
+enum class DebugEventType : uint32_t {
+  BeginBlock,
+  EndBlock,
+};
+
+struct DebugEvent {
+  uint64_t clock;
+  // NOTE: Has to outlive the event, so a string literal or __func__
+  const char *name;
+  DebugEventType type;
+  // NOTE: For EndBlock, how many items (pixels, samples) the block processed
+  uint32_t item_count;
+};
+
+struct DebugOpenBlock {
+  const char *name;
+  uint64_t begin_clock;
+  // NOTE: Spent in blocks opened inside this one
+  uint64_t child_cycle_count;
+};
+
+struct DebugThread {
+  // NOTE: 0 while the slot is free
+  std::atomic<uint64_t> thread_id;
+  std::atomic<uint64_t> write_index;
+  std::array<DebugEvent, DEBUG_EVENT_RING_CAPACITY> events;
+
+  // NOTE: Only touched by the reader. Blocks stay open across reads, e.g.
+  // when a worker is still busy at the end of the frame.
+  uint64_t read_index;
+  uint32_t open_block_count;
+  std::array<DebugOpenBlock, DEBUG_MAX_BLOCK_DEPTH> open_blocks;
+};
+
+/*
+ * NOTE: Blocks are told apart by their name's address, so two blocks with
+ * the same name in different places show up separately
+ */
+struct DebugBlockStats {
+  const char *name;
+  // NOTE: How many blocks it was nested in the first time it began
+  uint32_t depth;
+  uint64_t hit_count;
+  uint64_t cycle_count;
+  // NOTE: cycle_count minus what was spent in blocks nested inside it
+  uint64_t self_cycle_count;
+  uint64_t item_count;
+};
+
+struct DebugFrameStats {
+  uint64_t frame_count;
+  uint32_t block_count;
+  std::array<DebugBlockStats, DEBUG_MAX_BLOCK_STATS_COUNT> blocks;
+};
+
+struct DebugTable {
+  // NOTE: Taken together when the table was made, so clocks can be turned
+  // into time
+  uint64_t base_clock;
+  uint64_t base_nanoseconds;
+
+  std::array<DebugThread, DEBUG_MAX_THREAD_COUNT> threads;
+
+  // NOTE: Blocks that ended during the last frame, and summed over every
+  // frame since the platform last reported them
+  DebugFrameStats last_frame;
+  DebugFrameStats accumulated;
+};
+
+// NOTE: Set by the platform at startup and by game_update and game_render,
+// timed blocks record nothing while it's NULL
+static DebugTable *debug_global_table;
+
+static inline uint64_t debug_get_thread_id() {
+  // NOTE: On x86-64 Linux fs points at the thread's control block, whose
+  // first field points back at it. Unlike the address of a thread_local, it
+  // is the same from every loaded module.
+  uint64_t result;
+  asm volatile("mov %%fs:0, %0" : "=r"(result));
+  return result;
+}
+
+/*
+ * NOTE: A thread claims the first free slot the first time it records
+ * something. Slots are never given back, so a thread always finds its own
+ * slot before any free one.
+ */
+static inline DebugThread *debug_get_thread(DebugTable &table) {
+  static thread_local DebugThread *result;
+  if (!result) {
+    const uint64_t thread_id = debug_get_thread_id();
+    for (DebugThread &thread : table.threads) {
+      uint64_t owner = 0;
+      if (thread.thread_id.compare_exchange_strong(owner, thread_id) ||
+          owner == thread_id) {
+        result = &thread;
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+static inline void debug_record_event(const DebugEventType type,
+                                      const char *name,
+                                      const uint32_t item_count) {
+  if (debug_global_table) {
+    DebugThread *thread = debug_get_thread(*debug_global_table);
+    if (thread) {
+      const uint64_t index =
+          thread->write_index.load(std::memory_order_relaxed);
+      thread->events[index % DEBUG_EVENT_RING_CAPACITY] =
+          DebugEvent{__rdtsc(), name, type, item_count};
+      thread->write_index.store(index + 1, std::memory_order_release);
+    }
+  }
+}
+
+struct DebugTimedBlock {
+  const char *name;
+  uint32_t item_count;
+
+  DebugTimedBlock(const char *block_name, const uint32_t block_item_count = 0)
+      : name(block_name), item_count(block_item_count) {
+    debug_record_event(DebugEventType::BeginBlock, name, 0);
+  }
+  ~DebugTimedBlock() {
+    debug_record_event(DebugEventType::EndBlock, name, item_count);
+  }
+};
+
+#define DEBUG_CONCATENATE_(a, b) a##b
+#define DEBUG_CONCATENATE(a, b) DEBUG_CONCATENATE_(a, b)
+// NOTE: TIMED_BLOCK(name) or TIMED_BLOCK(name, item_count), until the end of
+// the scope
+#define TIMED_BLOCK(...)                                                       \
+  DebugTimedBlock DEBUG_CONCATENATE(timed_block_, __LINE__)(__VA_ARGS__)
+#define TIMED_FUNCTION() TIMED_BLOCK(__func__)
+// NOTE: For blocks that don't line up with a scope
+#define BEGIN_TIMED_BLOCK(name)                                                \
+  debug_record_event(DebugEventType::BeginBlock, name, 0)
+#define END_TIMED_BLOCK(name)                                                  \
+  debug_record_event(DebugEventType::EndBlock, name, 0)
+#else
+#define TIMED_BLOCK(...)
+#define TIMED_FUNCTION()
+#define BEGIN_TIMED_BLOCK(name)
+#define END_TIMED_BLOCK(name)
+#endif
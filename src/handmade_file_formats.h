@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * NOTE: On-disk layouts shared by the game and the offline tools. Every field
+ * is naturally aligned, so these can be read straight from a file.
+ */
+
+constexpr uint32_t riff_code(const char a, const char b, const char c,
+                             const char d) {
+  return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) |
+         ((uint32_t)d << 24);
+}
+
+/*
+ * NOTE: RIFF WAVE
+ */
+
+struct WavHeader {
+  uint32_t riff_id;
+  uint32_t size;
+  uint32_t wave_id;
+};
+
+struct WavChunkHeader {
+  uint32_t id;
+  uint32_t size;
+};
+
+struct WavFormat {
+  uint16_t format_tag;
+  uint16_t channel_count;
+  uint32_t samples_per_second;
+  uint32_t average_bytes_per_second;
+  uint16_t block_align;
+  uint16_t bits_per_sample;
+};
+
+/*
+ * NOTE: Asset pack, built by handmade_packer. A header, then one PackedAsset
+ * per AssetId (in AssetId order, type Missing when the asset wasn't packed),
+ * then the data of every asset, each starting on a 16 byte boundary.
+ *
+ * Bitmaps are width * height 32 bit 0xAARRGGBB pixels with premultiplied
+ * alpha, rows top to bottom with no padding. Sounds are sample_count frames
+ * of 16 bit PCM, interleaved when there are two channels.
+ */
+
+constexpr uint32_t ASSET_PACK_MAGIC = riff_code('h', 'h', 'a', 'p');
+constexpr uint32_t ASSET_PACK_VERSION = 2;
+constexpr uint64_t ASSET_PACK_DATA_ALIGNMENT = 16;
+
+enum class AssetId : uint32_t {
+  PlayerBitmap,
+  BloopSound,
+
+  Count,
+};
+constexpr uint32_t ASSET_COUNT = (uint32_t)AssetId::Count;
+
+enum class PackedAssetType : uint32_t {
+  Missing,
+  Bitmap,
+  Sound,
+};
+
+struct AssetPackHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t asset_count;
+  uint32_t reserved;
+  uint64_t assets_offset;
+};
+
+struct PackedBitmap {
+  uint32_t width;
+  uint32_t height;
+};
+
+struct PackedSound {
+  uint32_t channel_count;
+  uint32_t samples_per_second;
+  uint32_t sample_count;
+};
+
+struct PackedAsset {
+  uint64_t data_offset;
+  uint64_t data_size;
+  PackedAssetType type;
+  union {
+    PackedBitmap bitmap;
+    PackedSound sound;
+  };
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "handmade.h"
+
+#include <cstdint>
+
+/*
+ * NOTE: Linear allocator over a block handed out by the platform (see
+ * GameMemory). Nothing is ever freed individually; scratch allocations are
+ * wrapped in a TemporaryMemory scope, which rewinds the arena when it ends.
+ */
+struct MemoryArena {
+  uint64_t size;
+  uint8_t *base;
+  uint64_t used;
+  uint64_t high_water_mark;
+
+  int32_t temp_count;
+};
+
+struct TemporaryMemory {
+  MemoryArena *arena;
+  uint64_t used;
+};
+
+static inline void initialize_arena(MemoryArena *arena, const uint64_t size,
+                                    void *base) {
+  arena->size = size;
+  arena->base = (uint8_t *)base;
+  arena->used = 0;
+  arena->high_water_mark = 0;
+  arena->temp_count = 0;
+}
+
+static inline uint64_t get_alignment_offset(const MemoryArena *arena,
+                                            const uint64_t alignment) {
+  ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+  const uint64_t result_pointer = (uint64_t)(arena->base + arena->used);
+  const uint64_t alignment_mask = alignment - 1;
+  uint64_t alignment_offset = 0;
+  if (result_pointer & alignment_mask) {
+    alignment_offset = alignment - (result_pointer & alignment_mask);
+  }
+
+  return alignment_offset;
+}
+
+static inline void *push_size(MemoryArena *arena, const uint64_t size,
+                              const uint64_t alignment = 8) {
+  const uint64_t alignment_offset = get_alignment_offset(arena, alignment);
+  const uint64_t effective_size = size + alignment_offset;
+  ASSERT(arena->used + effective_size <= arena->size);
+
+  void *result = arena->base + arena->used + alignment_offset;
+  arena->used += effective_size;
+  if (arena->used > arena->high_water_mark) {
+    arena->high_water_mark = arena->used;
+  }
+
+  return result;
+}
+
+template <typename T>
+static inline T *push_struct(MemoryArena *arena,
+                             const uint64_t alignment = alignof(T)) {
+  return (T *)push_size(arena, sizeof(T), alignment);
+}
+
+template <typename T>
+static inline T *push_array(MemoryArena *arena, const uint64_t count,
+                            const uint64_t alignment = alignof(T)) {
+  return (T *)push_size(arena, count * sizeof(T), alignment);
+}
+
+static inline void sub_arena(MemoryArena *result, MemoryArena *arena,
+                             const uint64_t size,
+                             const uint64_t alignment = 16) {
+  initialize_arena(result, size, push_size(arena, size, alignment));
+}
+
+static inline TemporaryMemory begin_temporary_memory(MemoryArena *arena) {
+  TemporaryMemory result;
+  result.arena = arena;
+  result.used = arena->used;
+
+  ++arena->temp_count;
+
+  return result;
+}
+
+static inline void end_temporary_memory(const TemporaryMemory temp_memory) {
+  MemoryArena *arena = temp_memory.arena;
+  ASSERT(arena->used >= temp_memory.used);
+  ASSERT(arena->temp_count > 0);
+
+  arena->used = temp_memory.used;
+  --arena->temp_count;
+}
+
+// NOTE: Every scope opened during the frame must have been closed
+static inline void check_arena(const MemoryArena *arena) {
+  ASSERT(arena->temp_count == 0);
+}
@@ -0,0 +1,363 @@
+/*
+ * NOTE: Offline tool that builds the asset pack the game loads at runtime.
+ *
+ * Usage: handmade_packer <data directory> <output file>
+ *
+ * Source files that are missing are left out of the pack (their entry is
+ * marked Missing) rather than failing the build.
+ */
+
+#include "handmade_file_formats.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+constexpr uint32_t PLAYER_BITMAP_DIM = 32;
+
+struct PackerAsset {
+  PackedAsset packed;
+  void *data;
+};
+
+static void *packer_read_entire_file(const char *filename, uint64_t *size) {
+  void *result = NULL;
+  FILE *file = fopen(filename, "rb");
+  if (file) {
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (file_size > 0) {
+      result = malloc((size_t)file_size);
+      if (fread(result, 1, (size_t)file_size, file) == (size_t)file_size) {
+        *size = (uint64_t)file_size;
+      } else {
+        free(result);
+        result = NULL;
+      }
+    }
+    fclose(file);
+  }
+
+  return result;
+}
+
+static uint32_t packer_read_u16(const uint8_t *contents,
+                                const uint64_t offset) {
+  uint16_t result;
+  memcpy(&result, contents + offset, sizeof(result));
+  return result;
+}
+
+static uint32_t packer_read_u32(const uint8_t *contents,
+                                const uint64_t offset) {
+  uint32_t result;
+  memcpy(&result, contents + offset, sizeof(result));
+  return result;
+}
+
+// NOTE: The pixels the renderer blends are premultiplied by their alpha
+static uint32_t premultiply_alpha(const uint32_t red, const uint32_t green,
+                                  const uint32_t blue, const uint32_t alpha) {
+  return (alpha << 24) | (((red * alpha + 127) / 255) << 16) |
+         (((green * alpha + 127) / 255) << 8) | ((blue * alpha + 127) / 255);
+}
+
+static void pack_bitmap_pixels(PackerAsset &asset, const uint32_t width,
+                               const uint32_t height, uint32_t *pixels) {
+  asset.packed.type = PackedAssetType::Bitmap;
+  asset.packed.bitmap.width = width;
+  asset.packed.bitmap.height = height;
+  asset.packed.data_size = (uint64_t)width * height * sizeof(uint32_t);
+  asset.data = pixels;
+}
+
+// NOTE: Placeholder art for when there is no player.bmp
+static void pack_player_bitmap(PackerAsset &asset) {
+  const uint32_t pixel_count = PLAYER_BITMAP_DIM * PLAYER_BITMAP_DIM;
+  uint32_t *pixels = (uint32_t *)malloc(pixel_count * sizeof(uint32_t));
+
+  const int32_t half_dim = PLAYER_BITMAP_DIM / 2;
+  for (uint32_t y = 0; y < PLAYER_BITMAP_DIM; ++y) {
+    for (uint32_t x = 0; x < PLAYER_BITMAP_DIM; ++x) {
+      const int32_t dx = (int32_t)x - half_dim;
+      const int32_t dy = (int32_t)y - half_dim;
+      const bool inside = dx * dx + dy * dy < half_dim * half_dim;
+      pixels[y * PLAYER_BITMAP_DIM + x] =
+          inside ? premultiply_alpha(0xFF, 0xCC, 0x00, 0xFF) : 0;
+    }
+  }
+
+  pack_bitmap_pixels(asset, PLAYER_BITMAP_DIM, PLAYER_BITMAP_DIM, pixels);
+}
+
+/*
+ * NOTE: Uncompressed 24 bit, or 32 bit with or without channel masks
+ * (BI_BITFIELDS). Pixels are converted to the layout the platform presents,
+ * 0xAARRGGBB with red_mask 0xFF0000, green_mask 0xFF00 and blue_mask 0xFF,
+ * rows top to bottom, with alpha premultiplied. Bitmaps without an alpha
+ * mask are opaque.
+ */
+static bool pack_bmp(PackerAsset &asset, const char *filename) {
+  uint64_t size = 0;
+  uint8_t *contents = (uint8_t *)packer_read_entire_file(filename, &size);
+  if (!contents) {
+    return false;
+  }
+
+  constexpr uint32_t BI_RGB = 0;
+  constexpr uint32_t BI_BITFIELDS = 3;
+
+  bool result = false;
+  if (size >= 54 && packer_read_u16(contents, 0) == 0x4D42) {
+    const uint32_t pixel_offset = packer_read_u32(contents, 10);
+    const uint32_t header_size = packer_read_u32(contents, 14);
+    const int32_t signed_width = (int32_t)packer_read_u32(contents, 18);
+    const int32_t signed_height = (int32_t)packer_read_u32(contents, 22);
+    const uint32_t bits_per_pixel = packer_read_u16(contents, 28);
+    const uint32_t compression = packer_read_u32(contents, 30);
+
+    uint32_t red_mask = 0x00FF0000;
+    uint32_t green_mask = 0x0000FF00;
+    uint32_t blue_mask = 0x000000FF;
+    uint32_t alpha_mask = 0;
+    if (compression == BI_BITFIELDS && size >= 66) {
+      red_mask = packer_read_u32(contents, 54);
+      green_mask = packer_read_u32(contents, 58);
+      blue_mask = packer_read_u32(contents, 62);
+      // NOTE: Only V3 headers and up have room for the alpha mask
+      if (header_size >= 56 && size >= 70) {
+        alpha_mask = packer_read_u32(contents, 66);
+      }
+    }
+
+    // NOTE: Negative heights are top-down bitmaps
+    const uint32_t width = (uint32_t)abs(signed_width);
+    const uint32_t height = (uint32_t)abs(signed_height);
+    const bool is_bottom_up = signed_height > 0;
+    const uint32_t bytes_per_pixel = bits_per_pixel / 8;
+    const uint64_t stride = ((uint64_t)width * bytes_per_pixel + 3) & ~3ull;
+
+    const bool masks_are_bytes =
+        __builtin_popcount(red_mask) == 8 &&
+        __builtin_popcount(green_mask) == 8 &&
+        __builtin_popcount(blue_mask) == 8 &&
+        (alpha_mask == 0 || __builtin_popcount(alpha_mask) == 8);
+    const bool is_supported =
+        (bits_per_pixel == 24 && compression == BI_RGB) ||
+        (bits_per_pixel == 32 &&
+         (compression == BI_RGB || compression == BI_BITFIELDS));
+    if (width > 0 && height > 0 && masks_are_bytes && is_supported &&
+        pixel_offset + stride * height <= size) {
+      const uint32_t red_shift = (uint32_t)__builtin_ctz(red_mask);
+      const uint32_t green_shift = (uint32_t)__builtin_ctz(green_mask);
+      const uint32_t blue_shift = (uint32_t)__builtin_ctz(blue_mask);
+      const uint32_t alpha_shift =
+          alpha_mask ? (uint32_t)__builtin_ctz(alpha_mask) : 0;
+
+      uint32_t *pixels =
+          (uint32_t *)malloc((uint64_t)width * height * sizeof(uint32_t));
+      for (uint32_t y = 0; y < height; ++y) {
+        const uint32_t source_y = is_bottom_up ? height - 1 - y : y;
+        const uint8_t *source_row = contents + pixel_offset + source_y * stride;
+        for (uint32_t x = 0; x < width; ++x) {
+          uint32_t source = 0;
+          if (bytes_per_pixel == 4) {
+            memcpy(&source, source_row + x * 4, sizeof(source));
+          } else {
+            // NOTE: 24 bit pixels are stored blue, green, red
+            const uint8_t *at = source_row + x * 3;
+            source = (uint32_t)at[0] | ((uint32_t)at[1] << 8) |
+                     ((uint32_t)at[2] << 16);
+          }
+
+          const uint32_t alpha =
+              alpha_mask ? (source & alpha_mask) >> alpha_shift : 0xFF;
+          pixels[y * width + x] = premultiply_alpha(
+              (source & red_mask) >> red_shift,
+              (source & green_mask) >> green_shift,
+              (source & blue_mask) >> blue_shift, alpha);
+        }
+      }
+
+      pack_bitmap_pixels(asset, width, height, pixels);
+      result = true;
+    }
+  }
+
+  if (!result) {
+    fprintf(stderr, "%s: not a BMP file we can pack\n", filename);
+  }
+  free(contents);
+
+  return result;
+}
+
+/*
+ * NOTE: 16 bit PCM, mono or stereo. The samples are packed as they are, the
+ * game resamples at playback.
+ */
+static bool pack_wav(PackerAsset &asset, const char *filename) {
+  uint64_t size = 0;
+  uint8_t *contents = (uint8_t *)packer_read_entire_file(filename, &size);
+  if (!contents) {
+    fprintf(stderr, "%s: missing, left out of the pack\n", filename);
+    return false;
+  }
+
+  bool result = false;
+  WavHeader header;
+  if (size >= sizeof(header)) {
+    memcpy(&header, contents, sizeof(header));
+  }
+  if (size >= sizeof(header) &&
+      header.riff_id == riff_code('R', 'I', 'F', 'F') &&
+      header.wave_id == riff_code('W', 'A', 'V', 'E')) {
+    WavFormat format = {};
+    const uint8_t *data = NULL;
+    uint32_t data_size = 0;
+    uint64_t offset = sizeof(header);
+    while (offset + sizeof(WavChunkHeader) <= size) {
+      WavChunkHeader chunk;
+      memcpy(&chunk, contents + offset, sizeof(chunk));
+      const uint64_t body_offset = offset + sizeof(chunk);
+      if (body_offset + chunk.size > size) {
+        break;
+      }
+
+      switch (chunk.id) {
+      case riff_code('f', 'm', 't', ' '): {
+        if (chunk.size >= sizeof(format)) {
+          memcpy(&format, contents + body_offset, sizeof(format));
+        }
+      } break;
+      case riff_code('d', 'a', 't', 'a'): {
+        data = contents + body_offset;
+        data_size = chunk.size;
+      } break;
+      }
+
+      // NOTE: Chunks are padded to an even size
+      offset = body_offset + chunk.size + (chunk.size & 1);
+    }
+
+    if (data && format.format_tag == 1 && format.bits_per_sample == 16 &&
+        (format.channel_count == 1 || format.channel_count == 2) &&
+        format.samples_per_second > 0) {
+      const uint32_t frame_size =
+          format.channel_count * (uint32_t)sizeof(int16_t);
+      asset.packed.type = PackedAssetType::Sound;
+      asset.packed.sound.channel_count = format.channel_count;
+      asset.packed.sound.samples_per_second = format.samples_per_second;
+      asset.packed.sound.sample_count = data_size / frame_size;
+      asset.packed.data_size =
+          (uint64_t)asset.packed.sound.sample_count * frame_size;
+      asset.data = malloc(asset.packed.data_size);
+      memcpy(asset.data, data, asset.packed.data_size);
+      result = true;
+    }
+  }
+
+  if (!result) {
+    fprintf(stderr, "%s: not a 16 bit PCM WAV file, left out of the pack\n",
+            filename);
+  }
+  free(contents);
+
+  return result;
+}
+
+/*
+ * NOTE: Written under a temporary name and renamed over the pack, a running
+ * game keeps the pack mapped and would fault on a truncated one
+ */
+static bool write_asset_pack(const char *filename, PackerAsset *assets) {
+  AssetPackHeader header = {};
+  header.magic = ASSET_PACK_MAGIC;
+  header.version = ASSET_PACK_VERSION;
+  header.asset_count = ASSET_COUNT;
+  header.assets_offset = sizeof(header);
+
+  uint64_t offset = header.assets_offset + ASSET_COUNT * sizeof(PackedAsset);
+  for (uint32_t asset_index = 0; asset_index < ASSET_COUNT; ++asset_index) {
+    PackedAsset &packed = assets[asset_index].packed;
+    if (packed.type != PackedAssetType::Missing) {
+      offset = (offset + ASSET_PACK_DATA_ALIGNMENT - 1) &
+               ~(ASSET_PACK_DATA_ALIGNMENT - 1);
+      packed.data_offset = offset;
+      offset += packed.data_size;
+    }
+  }
+
+  char temporary_filename[4096];
+  if (snprintf(temporary_filename, sizeof(temporary_filename), "%s.tmp",
+               filename) >= (int)sizeof(temporary_filename)) {
+    fprintf(stderr, "%s: name too long\n", filename);
+    return false;
+  }
+  FILE *file = fopen(temporary_filename, "wb");
+  if (!file) {
+    fprintf(stderr, "%s: couldn't open for writing\n", temporary_filename);
+    return false;
+  }
+
+  bool result = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (uint32_t asset_index = 0; asset_index < ASSET_COUNT; ++asset_index) {
+    result = result && fwrite(&assets[asset_index].packed,
+                              sizeof(PackedAsset), 1, file) == 1;
+  }
+  static const uint8_t padding[ASSET_PACK_DATA_ALIGNMENT] = {};
+  for (uint32_t asset_index = 0; asset_index < ASSET_COUNT; ++asset_index) {
+    const PackerAsset &asset = assets[asset_index];
+    if (asset.packed.type != PackedAssetType::Missing) {
+      const uint64_t padding_size =
+          asset.packed.data_offset - (uint64_t)ftell(file);
+      result = result && fwrite(padding, 1, padding_size, file) == padding_size;
+      result = result && fwrite(asset.data, 1, asset.packed.data_size, file) ==
+                             asset.packed.data_size;
+    }
+  }
+
+  if (fclose(file) != 0) {
+    result = false;
+  }
+  if (!result) {
+    fprintf(stderr, "%s: write failed\n", temporary_filename);
+    remove(temporary_filename);
+  } else if (rename(temporary_filename, filename) != 0) {
+    fprintf(stderr, "%s: couldn't rename to %s\n", temporary_filename,
+            filename);
+    remove(temporary_filename);
+    result = false;
+  }
+
+  return result;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <data directory> <output file>\n", argv[0]);
+    return 1;
+  }
+  const char *data_directory = argv[1];
+  const char *output_filename = argv[2];
+
+  PackerAsset assets[ASSET_COUNT] = {};
+  char filename[4096];
+
+  snprintf(filename, sizeof(filename), "%s/player.bmp", data_directory);
+  if (!pack_bmp(assets[(uint32_t)AssetId::PlayerBitmap], filename)) {
+    pack_player_bitmap(assets[(uint32_t)AssetId::PlayerBitmap]);
+  }
+
+  snprintf(filename, sizeof(filename), "%s/bloop.wav", data_directory);
+  pack_wav(assets[(uint32_t)AssetId::BloopSound], filename);
+
+  const bool result = write_asset_pack(output_filename, assets);
+  for (PackerAsset &asset : assets) {
+    free(asset.data);
+  }
+
+  return result ? 0 : 1;
+}
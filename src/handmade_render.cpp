@@ -0,0 +1,974 @@
+#include "handmade_render.h"
+
+#include <algorithm>
+#include <cpuid.h>
+#include <cstring>
+#include <immintrin.h>
+
+#define HANDMADE_TARGET_AVX2 __attribute__((target("avx2")))
+
+static RenderKernels global_render_kernels;
+
+/*
+ * NOTE: Scalar reference kernels
+ */
+
+static void render_weird_gradient_scalar(const GameOffscreenBuffer &buffer,
+                                         const int blue_offset,
+                                         const int green_offset) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    for (uint32_t x = 0; x < buffer.width; ++x) {
+      uint8_t blue = (uint8_t)((int)x + blue_offset);
+      uint8_t green = (uint8_t)((int)y + green_offset);
+
+      *pixel++ = (uint32_t)((green << 8) | blue);
+    }
+
+    row += buffer.pitch;
+  }
+}
+
+static void clear_buffer_scalar(const GameOffscreenBuffer &buffer,
+                                const uint32_t color) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    for (uint32_t x = 0; x < buffer.width; ++x) {
+      *pixel++ = color;
+    }
+
+    row += buffer.pitch;
+  }
+}
+
+/*
+ * NOTE: x / 255 rounded to nearest, exact for every x up to 255 * 255. Every
+ * blend kernel uses this exact formula so they all agree bit for bit.
+ */
+static inline uint32_t divide_by_255(const uint32_t x) {
+  const uint32_t t = x + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+/*
+ * NOTE: Premultiplied alpha "over": dest = source + dest * (1 - alpha), for
+ * every channel including alpha. Fully opaque and fully transparent pixels
+ * come out exact.
+ */
+static void blend_bitmap_scalar(const GameOffscreenBuffer &buffer,
+                                const uint32_t *source,
+                                const uint32_t source_pitch) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+  const uint8_t *source_row = (const uint8_t *)source;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    const uint32_t *source_pixel = (const uint32_t *)source_row;
+    for (uint32_t x = 0; x < buffer.width; ++x) {
+      const uint32_t s = *source_pixel++;
+      const uint32_t d = *pixel;
+      const uint32_t inverse_alpha = 255 - (s >> 24);
+
+      uint32_t result = 0;
+      for (uint32_t shift = 0; shift < 32; shift += 8) {
+        const uint32_t channel =
+            ((s >> shift) & 0xFF) +
+            divide_by_255(((d >> shift) & 0xFF) * inverse_alpha);
+        result |= std::min(channel, 255u) << shift;
+      }
+      *pixel++ = result;
+    }
+
+    row += buffer.pitch;
+    source_row += source_pitch;
+  }
+}
+
+/*
+ * NOTE: sRGB <-> linear conversion tables, filled in by init_render_kernels.
+ * Going back to sRGB is indexed by the linear value quantized to 12 bits,
+ * which is fine enough for every 8 bit value to round trip. The padding is
+ * there because the AVX2 kernels gather 4 bytes at a time from it.
+ */
+static float global_srgb_to_linear[256];
+static uint8_t global_linear_to_srgb[4096 + 3];
+
+static void init_srgb_tables() {
+  for (uint32_t i = 0; i < 256; ++i) {
+    const float value = (float)i / 255.0f;
+    global_srgb_to_linear[i] =
+        value <= 0.04045f ? value / 12.92f
+                          : std::pow((value + 0.055f) / 1.055f, 2.4f);
+  }
+  for (uint32_t i = 0; i < 4096; ++i) {
+    const float value = (float)i / 4095.0f;
+    const float srgb = value <= 0.0031308f
+                           ? value * 12.92f
+                           : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    global_linear_to_srgb[i] = (uint8_t)(srgb * 255.0f + 0.5f);
+  }
+}
+
+/*
+ * NOTE: What every textured quad kernel needs, worked out once per quad.
+ * u = dx * u_axis_x + dy * u_axis_y (and likewise v) inverts the quad's axes,
+ * so u and v are the texture coordinates of a pixel and at the same time the
+ * quad's four edge functions: the pixel is inside when both are in [0, 1].
+ */
+struct TexturedQuadSetup {
+  float u_axis_x;
+  float u_axis_y;
+  float v_axis_x;
+  float v_axis_y;
+  // NOTE: One texel short of the bitmap's size, so the texels to the right
+  // of and below every sample are still inside it
+  float texel_scale_x;
+  float texel_scale_y;
+};
+
+// NOTE: Returns false for quads with no area and for bitmaps too small to
+// filter between two texels, both draw nothing
+static bool setup_textured_quad(const TexturedQuad &quad,
+                                TexturedQuadSetup *setup) {
+  if (quad.bitmap->width < 2 || quad.bitmap->height < 2) {
+    return false;
+  }
+  const float determinant =
+      quad.x_axis_x * quad.y_axis_y - quad.x_axis_y * quad.y_axis_x;
+  if (determinant == 0.0f) {
+    return false;
+  }
+
+  const float inverse_determinant = 1.0f / determinant;
+  setup->u_axis_x = quad.y_axis_y * inverse_determinant;
+  setup->u_axis_y = -quad.y_axis_x * inverse_determinant;
+  setup->v_axis_x = -quad.x_axis_y * inverse_determinant;
+  setup->v_axis_y = quad.x_axis_x * inverse_determinant;
+  setup->texel_scale_x = (float)(quad.bitmap->width - 2);
+  setup->texel_scale_y = (float)(quad.bitmap->height - 2);
+  return true;
+}
+
+/*
+ * NOTE: Color channels go through the sRGB table, alpha is linear already.
+ * The bitmaps are premultiplied in sRGB space, so running their channels
+ * through the table is an approximation, but a close one.
+ */
+static inline float unpack_linear(const uint32_t color, const uint32_t shift) {
+  const uint32_t channel = (color >> shift) & 0xFF;
+  return shift == 24 ? (float)channel * (1.0f / 255.0f)
+                     : global_srgb_to_linear[channel];
+}
+
+static inline uint32_t pack_linear(const float value, const uint32_t shift) {
+  const float channel = std::min(std::max(value, 0.0f), 1.0f);
+  return shift == 24 ? (uint32_t)(channel * 255.0f + 0.5f)
+                     : global_linear_to_srgb[(uint32_t)(channel * 4095.0f +
+                                                        0.5f)];
+}
+
+static inline float lerp(const float a, const float t, const float b) {
+  return a + t * (b - a);
+}
+
+/*
+ * NOTE: Draws pixels [min_x, max_x) of one row, dy being the row's distance
+ * from the quad's origin. Also finishes the rows of the SIMD kernels.
+ */
+static void draw_textured_quad_span_scalar(uint32_t *pixel,
+                                           const uint32_t min_x,
+                                           const uint32_t max_x,
+                                           const float dy,
+                                           const TexturedQuad &quad,
+                                           const TexturedQuadSetup &setup) {
+  const LoadedBitmap &bitmap = *quad.bitmap;
+  for (uint32_t x = min_x; x < max_x; ++x, ++pixel) {
+    const float dx = ((float)x + 0.5f) - quad.origin_x;
+    const float u = dx * setup.u_axis_x + dy * setup.u_axis_y;
+    const float v = dx * setup.v_axis_x + dy * setup.v_axis_y;
+    if (!(u >= 0.0f && u <= 1.0f && v >= 0.0f && v <= 1.0f)) {
+      continue;
+    }
+
+    const float texel_x = u * setup.texel_scale_x;
+    const float texel_y = v * setup.texel_scale_y;
+    const int32_t texel_index_x = (int32_t)texel_x;
+    const int32_t texel_index_y = (int32_t)texel_y;
+    const float fraction_x = texel_x - (float)texel_index_x;
+    const float fraction_y = texel_y - (float)texel_index_y;
+
+    const uint32_t *texel_row =
+        (const uint32_t *)((const uint8_t *)bitmap.memory +
+                           (uint32_t)texel_index_y * bitmap.pitch) +
+        texel_index_x;
+    const uint32_t *next_texel_row =
+        (const uint32_t *)((const uint8_t *)texel_row + bitmap.pitch);
+    const uint32_t texel_a = texel_row[0];
+    const uint32_t texel_b = texel_row[1];
+    const uint32_t texel_c = next_texel_row[0];
+    const uint32_t texel_d = next_texel_row[1];
+    const uint32_t dest = *pixel;
+
+    float texel[4];
+    for (uint32_t channel = 0; channel < 4; ++channel) {
+      const uint32_t shift = channel * 8;
+      texel[channel] = lerp(lerp(unpack_linear(texel_a, shift), fraction_x,
+                                 unpack_linear(texel_b, shift)),
+                            fraction_y,
+                            lerp(unpack_linear(texel_c, shift), fraction_x,
+                                 unpack_linear(texel_d, shift)));
+    }
+
+    const float inverse_alpha = 1.0f - texel[3];
+    uint32_t result = 0;
+    for (uint32_t channel = 0; channel < 4; ++channel) {
+      const uint32_t shift = channel * 8;
+      result |= pack_linear(texel[channel] +
+                                inverse_alpha * unpack_linear(dest, shift),
+                            shift)
+                << shift;
+    }
+    *pixel = result;
+  }
+}
+
+static void draw_textured_quad_scalar(const GameOffscreenBuffer &buffer,
+                                      const TexturedQuad &quad) {
+  TexturedQuadSetup setup;
+  if (!setup_textured_quad(quad, &setup)) {
+    return;
+  }
+
+  uint8_t *row = (uint8_t *)buffer.memory;
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    const float dy = ((float)y + 0.5f) - quad.origin_y;
+    draw_textured_quad_span_scalar((uint32_t *)row, 0, buffer.width, dy, quad,
+                                   setup);
+
+    row += buffer.pitch;
+  }
+}
+
+/*
+ * NOTE: SSE2, 4 pixels per store. Rows don't need to be aligned, the tail of
+ * each row is finished with the scalar loop.
+ */
+
+static void render_weird_gradient_sse2(const GameOffscreenBuffer &buffer,
+                                       const int blue_offset,
+                                       const int green_offset) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+  const __m128i byte_mask = _mm_set1_epi32(0xFF);
+  const __m128i lane_offsets = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128i four = _mm_set1_epi32(4);
+  const uint32_t wide_width = buffer.width & ~3u;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    const uint8_t green = (uint8_t)((int)y + green_offset);
+    const __m128i green_bits = _mm_set1_epi32(green << 8);
+    __m128i blue =
+        _mm_add_epi32(_mm_set1_epi32(blue_offset), lane_offsets);
+
+    uint32_t x = 0;
+    for (; x < wide_width; x += 4) {
+      __m128i color = _mm_or_si128(_mm_and_si128(blue, byte_mask), green_bits);
+      _mm_storeu_si128((__m128i *)pixel, color);
+      pixel += 4;
+      blue = _mm_add_epi32(blue, four);
+    }
+    for (; x < buffer.width; ++x) {
+      *pixel++ = (uint32_t)((green << 8) | (uint8_t)((int)x + blue_offset));
+    }
+
+    row += buffer.pitch;
+  }
+}
+
+static void clear_buffer_sse2(const GameOffscreenBuffer &buffer,
+                              const uint32_t color) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+  const __m128i wide_color = _mm_set1_epi32((int)color);
+  const uint32_t wide_width = buffer.width & ~3u;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    uint32_t x = 0;
+    for (; x < wide_width; x += 4) {
+      _mm_storeu_si128((__m128i *)pixel, wide_color);
+      pixel += 4;
+    }
+    for (; x < buffer.width; ++x) {
+      *pixel++ = color;
+    }
+
+    row += buffer.pitch;
+  }
+}
+
+/*
+ * NOTE: Widens each channel to 16 bits, so 4 pixels take two registers. The
+ * alpha of every pixel is splatted over its 4 channels with shufflelo/hi.
+ */
+static inline __m128i blend_premultiplied_sse2(const __m128i source,
+                                               const __m128i dest) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max_channel = _mm_set1_epi16(255);
+  const __m128i half = _mm_set1_epi16(128);
+
+  const __m128i source_low = _mm_unpacklo_epi8(source, zero);
+  const __m128i source_high = _mm_unpackhi_epi8(source, zero);
+  const __m128i inverse_alpha_low = _mm_sub_epi16(
+      max_channel,
+      _mm_shufflehi_epi16(_mm_shufflelo_epi16(source_low, 0xFF), 0xFF));
+  const __m128i inverse_alpha_high = _mm_sub_epi16(
+      max_channel,
+      _mm_shufflehi_epi16(_mm_shufflelo_epi16(source_high, 0xFF), 0xFF));
+
+  __m128i dest_low = _mm_add_epi16(
+      _mm_mullo_epi16(_mm_unpacklo_epi8(dest, zero), inverse_alpha_low), half);
+  __m128i dest_high = _mm_add_epi16(
+      _mm_mullo_epi16(_mm_unpackhi_epi8(dest, zero), inverse_alpha_high),
+      half);
+  dest_low =
+      _mm_srli_epi16(_mm_add_epi16(dest_low, _mm_srli_epi16(dest_low, 8)), 8);
+  dest_high =
+      _mm_srli_epi16(_mm_add_epi16(dest_high, _mm_srli_epi16(dest_high, 8)), 8);
+
+  return _mm_adds_epu8(source, _mm_packus_epi16(dest_low, dest_high));
+}
+
+/*
+ * NOTE: Sprites are mostly fully opaque or fully transparent, so those
+ * blocks of 4 skip the math (and the load of dest)
+ */
+static void blend_bitmap_sse2(const GameOffscreenBuffer &buffer,
+                              const uint32_t *source,
+                              const uint32_t source_pitch) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+  const uint8_t *source_row = (const uint8_t *)source;
+  const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+  const uint32_t wide_width = buffer.width & ~3u;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    const uint32_t *source_pixel = (const uint32_t *)source_row;
+
+    uint32_t x = 0;
+    for (; x < wide_width; x += 4) {
+      const __m128i s = _mm_loadu_si128((const __m128i *)source_pixel);
+      const __m128i alpha = _mm_and_si128(s, alpha_mask);
+      const int opaque_mask =
+          _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alpha_mask));
+      const int transparent_mask =
+          _mm_movemask_epi8(_mm_cmpeq_epi32(s, _mm_setzero_si128()));
+      if (opaque_mask == 0xFFFF) {
+        _mm_storeu_si128((__m128i *)pixel, s);
+      } else if (transparent_mask != 0xFFFF) {
+        const __m128i d = _mm_loadu_si128((const __m128i *)pixel);
+        _mm_storeu_si128((__m128i *)pixel, blend_premultiplied_sse2(s, d));
+      }
+      pixel += 4;
+      source_pixel += 4;
+    }
+    if (x < buffer.width) {
+      const GameOffscreenBuffer tail{pixel, buffer.width - x, 1, buffer.pitch};
+      blend_bitmap_scalar(tail, source_pixel, source_pitch);
+    }
+
+    row += buffer.pitch;
+    source_row += source_pitch;
+  }
+}
+
+/*
+ * NOTE: SSE2 has no gathers, so texels and table entries are fetched a lane
+ * at a time. Everything in between is done 4 pixels at once.
+ */
+static inline __m128 lookup_srgb_to_linear_sse2(const __m128i color,
+                                                const int shift) {
+  alignas(16) uint32_t channel[4];
+  _mm_store_si128((__m128i *)channel,
+                  _mm_and_si128(_mm_srli_epi32(color, shift),
+                                _mm_set1_epi32(0xFF)));
+  return _mm_setr_ps(
+      global_srgb_to_linear[channel[0]], global_srgb_to_linear[channel[1]],
+      global_srgb_to_linear[channel[2]], global_srgb_to_linear[channel[3]]);
+}
+
+static inline __m128 unpack_alpha_sse2(const __m128i color) {
+  return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(color, 24)),
+                    _mm_set1_ps(1.0f / 255.0f));
+}
+
+static inline __m128i lookup_linear_to_srgb_sse2(const __m128 value) {
+  const __m128 channel =
+      _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+  alignas(16) uint32_t index[4];
+  _mm_store_si128((__m128i *)index,
+                  _mm_cvttps_epi32(_mm_add_ps(
+                      _mm_mul_ps(channel, _mm_set1_ps(4095.0f)),
+                      _mm_set1_ps(0.5f))));
+  return _mm_setr_epi32(
+      global_linear_to_srgb[index[0]], global_linear_to_srgb[index[1]],
+      global_linear_to_srgb[index[2]], global_linear_to_srgb[index[3]]);
+}
+
+static inline __m128 lerp_sse2(const __m128 a, const __m128 t,
+                               const __m128 b) {
+  return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+static void draw_textured_quad_sse2(const GameOffscreenBuffer &buffer,
+                                    const TexturedQuad &quad) {
+  TexturedQuadSetup setup;
+  if (!setup_textured_quad(quad, &setup)) {
+    return;
+  }
+
+  const LoadedBitmap &bitmap = *quad.bitmap;
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128i lane_offsets = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128 origin_x = _mm_set1_ps(quad.origin_x);
+  const __m128 u_axis_x = _mm_set1_ps(setup.u_axis_x);
+  const __m128 v_axis_x = _mm_set1_ps(setup.v_axis_x);
+  const __m128 texel_scale_x = _mm_set1_ps(setup.texel_scale_x);
+  const __m128 texel_scale_y = _mm_set1_ps(setup.texel_scale_y);
+  const uint32_t wide_width = buffer.width & ~3u;
+
+  uint8_t *row = (uint8_t *)buffer.memory;
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    const float dy = ((float)y + 0.5f) - quad.origin_y;
+    const __m128 u_row = _mm_set1_ps(dy * setup.u_axis_y);
+    const __m128 v_row = _mm_set1_ps(dy * setup.v_axis_y);
+
+    uint32_t x = 0;
+    for (; x < wide_width; x += 4, pixel += 4) {
+      const __m128 dx = _mm_sub_ps(
+          _mm_add_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32((int)x),
+                                                   lane_offsets)),
+                     half),
+          origin_x);
+      __m128 u = _mm_add_ps(_mm_mul_ps(dx, u_axis_x), u_row);
+      __m128 v = _mm_add_ps(_mm_mul_ps(dx, v_axis_x), v_row);
+      const __m128 inside =
+          _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)),
+                     _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(v, one)));
+      if (_mm_movemask_ps(inside) == 0) {
+        continue;
+      }
+
+      // NOTE: Lanes outside the quad still fetch texels, from the edge
+      u = _mm_min_ps(_mm_max_ps(u, zero), one);
+      v = _mm_min_ps(_mm_max_ps(v, zero), one);
+      const __m128 texel_x = _mm_mul_ps(u, texel_scale_x);
+      const __m128 texel_y = _mm_mul_ps(v, texel_scale_y);
+      const __m128i texel_index_x = _mm_cvttps_epi32(texel_x);
+      const __m128i texel_index_y = _mm_cvttps_epi32(texel_y);
+      const __m128 fraction_x =
+          _mm_sub_ps(texel_x, _mm_cvtepi32_ps(texel_index_x));
+      const __m128 fraction_y =
+          _mm_sub_ps(texel_y, _mm_cvtepi32_ps(texel_index_y));
+
+      alignas(16) int32_t index_x[4];
+      alignas(16) int32_t index_y[4];
+      _mm_store_si128((__m128i *)index_x, texel_index_x);
+      _mm_store_si128((__m128i *)index_y, texel_index_y);
+      alignas(16) uint32_t texels[4][4];
+      for (uint32_t lane = 0; lane < 4; ++lane) {
+        const uint32_t *texel_row =
+            (const uint32_t *)((const uint8_t *)bitmap.memory +
+                               (uint32_t)index_y[lane] * bitmap.pitch) +
+            index_x[lane];
+        const uint32_t *next_texel_row =
+            (const uint32_t *)((const uint8_t *)texel_row + bitmap.pitch);
+        texels[0][lane] = texel_row[0];
+        texels[1][lane] = texel_row[1];
+        texels[2][lane] = next_texel_row[0];
+        texels[3][lane] = next_texel_row[1];
+      }
+      const __m128i texel_a = _mm_load_si128((const __m128i *)texels[0]);
+      const __m128i texel_b = _mm_load_si128((const __m128i *)texels[1]);
+      const __m128i texel_c = _mm_load_si128((const __m128i *)texels[2]);
+      const __m128i texel_d = _mm_load_si128((const __m128i *)texels[3]);
+      const __m128i dest = _mm_loadu_si128((const __m128i *)pixel);
+
+      const __m128 texel_alpha = lerp_sse2(
+          lerp_sse2(unpack_alpha_sse2(texel_a), fraction_x,
+                    unpack_alpha_sse2(texel_b)),
+          fraction_y,
+          lerp_sse2(unpack_alpha_sse2(texel_c), fraction_x,
+                    unpack_alpha_sse2(texel_d)));
+      const __m128 inverse_alpha = _mm_sub_ps(one, texel_alpha);
+      const __m128 alpha = _mm_min_ps(
+          _mm_max_ps(_mm_add_ps(texel_alpha,
+                                _mm_mul_ps(inverse_alpha,
+                                           unpack_alpha_sse2(dest))),
+                     zero),
+          one);
+      __m128i result = _mm_slli_epi32(
+          _mm_cvttps_epi32(
+              _mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(255.0f)), half)),
+          24);
+      for (int shift = 0; shift < 24; shift += 8) {
+        const __m128 texel = lerp_sse2(
+            lerp_sse2(lookup_srgb_to_linear_sse2(texel_a, shift), fraction_x,
+                      lookup_srgb_to_linear_sse2(texel_b, shift)),
+            fraction_y,
+            lerp_sse2(lookup_srgb_to_linear_sse2(texel_c, shift), fraction_x,
+                      lookup_srgb_to_linear_sse2(texel_d, shift)));
+        const __m128 channel = _mm_add_ps(
+            texel,
+            _mm_mul_ps(inverse_alpha, lookup_srgb_to_linear_sse2(dest, shift)));
+        result = _mm_or_si128(
+            result,
+            _mm_slli_epi32(lookup_linear_to_srgb_sse2(channel), shift));
+      }
+
+      const __m128i inside_mask = _mm_castps_si128(inside);
+      _mm_storeu_si128((__m128i *)pixel,
+                       _mm_or_si128(_mm_and_si128(inside_mask, result),
+                                    _mm_andnot_si128(inside_mask, dest)));
+    }
+    draw_textured_quad_span_scalar(pixel, x, buffer.width, dy, quad, setup);
+
+    row += buffer.pitch;
+  }
+}
+
+/*
+ * NOTE: AVX2, 8 pixels per store
+ */
+
+HANDMADE_TARGET_AVX2
+static void render_weird_gradient_avx2(const GameOffscreenBuffer &buffer,
+                                       const int blue_offset,
+                                       const int green_offset) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+  const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+  const __m256i lane_offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i eight = _mm256_set1_epi32(8);
+  const uint32_t wide_width = buffer.width & ~7u;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    const uint8_t green = (uint8_t)((int)y + green_offset);
+    const __m256i green_bits = _mm256_set1_epi32(green << 8);
+    __m256i blue =
+        _mm256_add_epi32(_mm256_set1_epi32(blue_offset), lane_offsets);
+
+    uint32_t x = 0;
+    for (; x < wide_width; x += 8) {
+      __m256i color =
+          _mm256_or_si256(_mm256_and_si256(blue, byte_mask), green_bits);
+      _mm256_storeu_si256((__m256i *)pixel, color);
+      pixel += 8;
+      blue = _mm256_add_epi32(blue, eight);
+    }
+    for (; x < buffer.width; ++x) {
+      *pixel++ = (uint32_t)((green << 8) | (uint8_t)((int)x + blue_offset));
+    }
+
+    row += buffer.pitch;
+  }
+}
+
+HANDMADE_TARGET_AVX2
+static void clear_buffer_avx2(const GameOffscreenBuffer &buffer,
+                              const uint32_t color) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+  const __m256i wide_color = _mm256_set1_epi32((int)color);
+  const uint32_t wide_width = buffer.width & ~7u;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    uint32_t x = 0;
+    for (; x < wide_width; x += 8) {
+      _mm256_storeu_si256((__m256i *)pixel, wide_color);
+      pixel += 8;
+    }
+    for (; x < buffer.width; ++x) {
+      *pixel++ = color;
+    }
+
+    row += buffer.pitch;
+  }
+}
+
+// NOTE: Same as the SSE2 version, unpack and pack both work per 128 bit lane
+HANDMADE_TARGET_AVX2
+static inline __m256i blend_premultiplied_avx2(const __m256i source,
+                                               const __m256i dest) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max_channel = _mm256_set1_epi16(255);
+  const __m256i half = _mm256_set1_epi16(128);
+
+  const __m256i source_low = _mm256_unpacklo_epi8(source, zero);
+  const __m256i source_high = _mm256_unpackhi_epi8(source, zero);
+  const __m256i inverse_alpha_low = _mm256_sub_epi16(
+      max_channel,
+      _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(source_low, 0xFF), 0xFF));
+  const __m256i inverse_alpha_high = _mm256_sub_epi16(
+      max_channel,
+      _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(source_high, 0xFF), 0xFF));
+
+  __m256i dest_low = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(dest, zero), inverse_alpha_low),
+      half);
+  __m256i dest_high = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(dest, zero), inverse_alpha_high),
+      half);
+  dest_low = _mm256_srli_epi16(
+      _mm256_add_epi16(dest_low, _mm256_srli_epi16(dest_low, 8)), 8);
+  dest_high = _mm256_srli_epi16(
+      _mm256_add_epi16(dest_high, _mm256_srli_epi16(dest_high, 8)), 8);
+
+  return _mm256_adds_epu8(source, _mm256_packus_epi16(dest_low, dest_high));
+}
+
+HANDMADE_TARGET_AVX2
+static void blend_bitmap_avx2(const GameOffscreenBuffer &buffer,
+                              const uint32_t *source,
+                              const uint32_t source_pitch) {
+  uint8_t *row = (uint8_t *)buffer.memory;
+  const uint8_t *source_row = (const uint8_t *)source;
+  const __m256i alpha_mask = _mm256_set1_epi32((int)0xFF000000);
+  const uint32_t wide_width = buffer.width & ~7u;
+
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    const uint32_t *source_pixel = (const uint32_t *)source_row;
+
+    uint32_t x = 0;
+    for (; x < wide_width; x += 8) {
+      const __m256i s = _mm256_loadu_si256((const __m256i *)source_pixel);
+      const __m256i alpha = _mm256_and_si256(s, alpha_mask);
+      const uint32_t opaque_mask = (uint32_t)_mm256_movemask_epi8(
+          _mm256_cmpeq_epi32(alpha, alpha_mask));
+      const uint32_t transparent_mask = (uint32_t)_mm256_movemask_epi8(
+          _mm256_cmpeq_epi32(s, _mm256_setzero_si256()));
+      if (opaque_mask == 0xFFFFFFFF) {
+        _mm256_storeu_si256((__m256i *)pixel, s);
+      } else if (transparent_mask != 0xFFFFFFFF) {
+        const __m256i d = _mm256_loadu_si256((const __m256i *)pixel);
+        _mm256_storeu_si256((__m256i *)pixel, blend_premultiplied_avx2(s, d));
+      }
+      pixel += 8;
+      source_pixel += 8;
+    }
+    if (x < buffer.width) {
+      const GameOffscreenBuffer tail{pixel, buffer.width - x, 1, buffer.pitch};
+      blend_bitmap_scalar(tail, source_pixel, source_pitch);
+    }
+
+    row += buffer.pitch;
+    source_row += source_pitch;
+  }
+}
+
+/*
+ * NOTE: Texels and both conversion tables are fetched with gathers. The
+ * linear to sRGB table is gathered 4 bytes at a time and masked.
+ */
+HANDMADE_TARGET_AVX2
+static inline __m256 lookup_srgb_to_linear_avx2(const __m256i color,
+                                                const int shift) {
+  return _mm256_i32gather_ps(
+      global_srgb_to_linear,
+      _mm256_and_si256(_mm256_srli_epi32(color, shift),
+                       _mm256_set1_epi32(0xFF)),
+      4);
+}
+
+HANDMADE_TARGET_AVX2
+static inline __m256 unpack_alpha_avx2(const __m256i color) {
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(color, 24)),
+                       _mm256_set1_ps(1.0f / 255.0f));
+}
+
+HANDMADE_TARGET_AVX2
+static inline __m256i lookup_linear_to_srgb_avx2(const __m256 value) {
+  const __m256 channel = _mm256_min_ps(
+      _mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+  const __m256i index = _mm256_cvttps_epi32(_mm256_add_ps(
+      _mm256_mul_ps(channel, _mm256_set1_ps(4095.0f)), _mm256_set1_ps(0.5f)));
+  return _mm256_and_si256(
+      _mm256_i32gather_epi32((const int *)global_linear_to_srgb, index, 1),
+      _mm256_set1_epi32(0xFF));
+}
+
+HANDMADE_TARGET_AVX2
+static inline __m256 lerp_avx2(const __m256 a, const __m256 t,
+                               const __m256 b) {
+  return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+HANDMADE_TARGET_AVX2
+static void draw_textured_quad_avx2(const GameOffscreenBuffer &buffer,
+                                    const TexturedQuad &quad) {
+  TexturedQuadSetup setup;
+  if (!setup_textured_quad(quad, &setup)) {
+    return;
+  }
+
+  const LoadedBitmap &bitmap = *quad.bitmap;
+  ASSERT(bitmap.pitch % sizeof(uint32_t) == 0);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256i lane_offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 origin_x = _mm256_set1_ps(quad.origin_x);
+  const __m256 u_axis_x = _mm256_set1_ps(setup.u_axis_x);
+  const __m256 v_axis_x = _mm256_set1_ps(setup.v_axis_x);
+  const __m256 texel_scale_x = _mm256_set1_ps(setup.texel_scale_x);
+  const __m256 texel_scale_y = _mm256_set1_ps(setup.texel_scale_y);
+  const __m256i texel_pitch =
+      _mm256_set1_epi32((int)(bitmap.pitch / sizeof(uint32_t)));
+  const __m256i next_texel = _mm256_set1_epi32(1);
+  const int *texels = (const int *)bitmap.memory;
+  const uint32_t wide_width = buffer.width & ~7u;
+
+  uint8_t *row = (uint8_t *)buffer.memory;
+  for (uint32_t y = 0; y < buffer.height; ++y) {
+    uint32_t *pixel = (uint32_t *)row;
+    const float dy = ((float)y + 0.5f) - quad.origin_y;
+    const __m256 u_row = _mm256_set1_ps(dy * setup.u_axis_y);
+    const __m256 v_row = _mm256_set1_ps(dy * setup.v_axis_y);
+
+    uint32_t x = 0;
+    for (; x < wide_width; x += 8, pixel += 8) {
+      const __m256 dx = _mm256_sub_ps(
+          _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(
+                            _mm256_set1_epi32((int)x), lane_offsets)),
+                        half),
+          origin_x);
+      __m256 u = _mm256_add_ps(_mm256_mul_ps(dx, u_axis_x), u_row);
+      __m256 v = _mm256_add_ps(_mm256_mul_ps(dx, v_axis_x), v_row);
+      const __m256 inside = _mm256_and_ps(
+          _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ),
+                        _mm256_cmp_ps(u, one, _CMP_LE_OQ)),
+          _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ),
+                        _mm256_cmp_ps(v, one, _CMP_LE_OQ)));
+      if (_mm256_movemask_ps(inside) == 0) {
+        continue;
+      }
+
+      u = _mm256_min_ps(_mm256_max_ps(u, zero), one);
+      v = _mm256_min_ps(_mm256_max_ps(v, zero), one);
+      const __m256 texel_x = _mm256_mul_ps(u, texel_scale_x);
+      const __m256 texel_y = _mm256_mul_ps(v, texel_scale_y);
+      const __m256i texel_index_x = _mm256_cvttps_epi32(texel_x);
+      const __m256i texel_index_y = _mm256_cvttps_epi32(texel_y);
+      const __m256 fraction_x =
+          _mm256_sub_ps(texel_x, _mm256_cvtepi32_ps(texel_index_x));
+      const __m256 fraction_y =
+          _mm256_sub_ps(texel_y, _mm256_cvtepi32_ps(texel_index_y));
+
+      const __m256i index_a = _mm256_add_epi32(
+          _mm256_mullo_epi32(texel_index_y, texel_pitch), texel_index_x);
+      const __m256i index_c = _mm256_add_epi32(index_a, texel_pitch);
+      const __m256i texel_a = _mm256_i32gather_epi32(texels, index_a, 4);
+      const __m256i texel_b = _mm256_i32gather_epi32(
+          texels, _mm256_add_epi32(index_a, next_texel), 4);
+      const __m256i texel_c = _mm256_i32gather_epi32(texels, index_c, 4);
+      const __m256i texel_d = _mm256_i32gather_epi32(
+          texels, _mm256_add_epi32(index_c, next_texel), 4);
+      const __m256i dest = _mm256_loadu_si256((const __m256i *)pixel);
+
+      const __m256 texel_alpha = lerp_avx2(
+          lerp_avx2(unpack_alpha_avx2(texel_a), fraction_x,
+                    unpack_alpha_avx2(texel_b)),
+          fraction_y,
+          lerp_avx2(unpack_alpha_avx2(texel_c), fraction_x,
+                    unpack_alpha_avx2(texel_d)));
+      const __m256 inverse_alpha = _mm256_sub_ps(one, texel_alpha);
+      const __m256 alpha = _mm256_min_ps(
+          _mm256_max_ps(_mm256_add_ps(texel_alpha,
+                                      _mm256_mul_ps(inverse_alpha,
+                                                    unpack_alpha_avx2(dest))),
+                        zero),
+          one);
+      __m256i result = _mm256_slli_epi32(
+          _mm256_cvttps_epi32(_mm256_add_ps(
+              _mm256_mul_ps(alpha, _mm256_set1_ps(255.0f)), half)),
+          24);
+      for (int shift = 0; shift < 24; shift += 8) {
+        const __m256 texel = lerp_avx2(
+            lerp_avx2(lookup_srgb_to_linear_avx2(texel_a, shift), fraction_x,
+                      lookup_srgb_to_linear_avx2(texel_b, shift)),
+            fraction_y,
+            lerp_avx2(lookup_srgb_to_linear_avx2(texel_c, shift), fraction_x,
+                      lookup_srgb_to_linear_avx2(texel_d, shift)));
+        const __m256 channel = _mm256_add_ps(
+            texel, _mm256_mul_ps(inverse_alpha,
+                                 lookup_srgb_to_linear_avx2(dest, shift)));
+        result = _mm256_or_si256(
+            result,
+            _mm256_slli_epi32(lookup_linear_to_srgb_avx2(channel), shift));
+      }
+
+      const __m256i inside_mask = _mm256_castps_si256(inside);
+      _mm256_storeu_si256(
+          (__m256i *)pixel,
+          _mm256_or_si256(_mm256_and_si256(inside_mask, result),
+                          _mm256_andnot_si256(inside_mask, dest)));
+    }
+    draw_textured_quad_span_scalar(pixel, x, buffer.width, dy, quad, setup);
+
+    row += buffer.pitch;
+  }
+}
+
+/*
+ * NOTE: Runtime dispatch
+ */
+
+static bool cpu_supports_sse2() {
+  uint32_t eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return (edx & bit_SSE2) != 0;
+}
+
+static bool cpu_supports_avx2() {
+  uint32_t eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  // NOTE: The OS must also save the YMM registers on context switches
+  const bool has_osxsave = (ecx & bit_OSXSAVE) != 0;
+  const bool has_avx = (ecx & bit_AVX) != 0;
+  if (!has_osxsave || !has_avx) {
+    return false;
+  }
+  uint32_t xcr0_low, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  if ((xcr0_low & 0x6) != 0x6) {
+    return false;
+  }
+
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return (ebx & bit_AVX2) != 0;
+}
+
+static RenderKernels get_render_kernels(const RenderKernelSet kernel_set) {
+  RenderKernels result = {RenderKernelSet::Scalar, render_weird_gradient_scalar,
+                          clear_buffer_scalar, blend_bitmap_scalar,
+                          draw_textured_quad_scalar};
+  switch (kernel_set) {
+  case RenderKernelSet::AVX2: {
+    result = {kernel_set, render_weird_gradient_avx2, clear_buffer_avx2,
+              blend_bitmap_avx2, draw_textured_quad_avx2};
+  } break;
+  case RenderKernelSet::SSE2: {
+    result = {kernel_set, render_weird_gradient_sse2, clear_buffer_sse2,
+              blend_bitmap_sse2, draw_textured_quad_sse2};
+  } break;
+  case RenderKernelSet::Scalar: {
+  } break;
+  }
+
+  return result;
+}
+
+#if HANDMADE_SLOW
+// NOTE: Odd sizes so the scalar tails of the SIMD loops are exercised too
+static void check_render_kernels(const RenderKernels &kernels) {
+  constexpr uint32_t width = 37;
+  constexpr uint32_t height = 5;
+  constexpr uint32_t pitch = (width + 3) * sizeof(uint32_t);
+  static uint32_t expected[height * pitch / sizeof(uint32_t)];
+  static uint32_t actual[height * pitch / sizeof(uint32_t)];
+  const GameOffscreenBuffer expected_buffer{expected, width, height, pitch};
+  const GameOffscreenBuffer actual_buffer{actual, width, height, pitch};
+
+  render_weird_gradient_scalar(expected_buffer, -3, 250);
+  kernels.render_weird_gradient(actual_buffer, -3, 250);
+  ASSERT(memcmp(expected, actual, sizeof(expected)) == 0);
+
+  clear_buffer_scalar(expected_buffer, 0xFF336699);
+  kernels.clear_buffer(actual_buffer, 0xFF336699);
+  ASSERT(memcmp(expected, actual, sizeof(expected)) == 0);
+
+  // NOTE: Premultiplied pixels with every kind of alpha, with whole blocks
+  // of opaque and of transparent pixels to hit the shortcuts
+  static uint32_t source[height * pitch / sizeof(uint32_t)];
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < height * pitch / sizeof(uint32_t); ++i) {
+    seed = seed * 1664525 + 1013904223;
+    uint32_t alpha = seed >> 24;
+    if ((i / 8) % 3 == 1) {
+      alpha = 255;
+    } else if ((i / 8) % 3 == 2) {
+      alpha = 0;
+    }
+    uint32_t pixel = alpha << 24;
+    for (uint32_t shift = 0; shift < 24; shift += 8) {
+      pixel |= divide_by_255(((seed >> shift) & 0xFF) * alpha) << shift;
+    }
+    source[i] = pixel;
+  }
+  render_weird_gradient_scalar(expected_buffer, 7, 11);
+  render_weird_gradient_scalar(actual_buffer, 7, 11);
+  blend_bitmap_scalar(expected_buffer, source, pitch);
+  kernels.blend_bitmap(actual_buffer, source, pitch);
+  ASSERT(memcmp(expected, actual, sizeof(expected)) == 0);
+
+  // NOTE: Rotated and scaled so it covers part of the buffer, with edges
+  // crossing the SIMD blocks
+  const LoadedBitmap bitmap{8, height, pitch, source};
+  const TexturedQuad quad{10.3f, -2.7f, 20.0f, 6.0f, -3.0f, 9.5f, &bitmap};
+  render_weird_gradient_scalar(expected_buffer, 7, 11);
+  render_weird_gradient_scalar(actual_buffer, 7, 11);
+  draw_textured_quad_scalar(expected_buffer, quad);
+  kernels.draw_textured_quad(actual_buffer, quad);
+  ASSERT(memcmp(expected, actual, sizeof(expected)) == 0);
+}
+#endif
+
+static void init_render_kernels() {
+  RenderKernelSet kernel_set = RenderKernelSet::Scalar;
+  if (cpu_supports_avx2()) {
+    kernel_set = RenderKernelSet::AVX2;
+  } else if (cpu_supports_sse2()) {
+    kernel_set = RenderKernelSet::SSE2;
+  }
+
+  init_srgb_tables();
+  global_render_kernels = get_render_kernels(kernel_set);
+#if HANDMADE_SLOW
+  check_render_kernels(global_render_kernels);
+#endif
+}
+
+static void render_weird_gradient(const GameOffscreenBuffer &buffer,
+                                  const int blue_offset,
+                                  const int green_offset) {
+  global_render_kernels.render_weird_gradient(buffer, blue_offset,
+                                              green_offset);
+}
+
+static void clear_buffer(const GameOffscreenBuffer &buffer,
+                         const uint32_t color) {
+  global_render_kernels.clear_buffer(buffer, color);
+}
+
+static void blend_bitmap(const GameOffscreenBuffer &buffer,
+                         const uint32_t *source, const uint32_t source_pitch) {
+  global_render_kernels.blend_bitmap(buffer, source, source_pitch);
+}
+
+static void draw_textured_quad(const GameOffscreenBuffer &buffer,
+                               const TexturedQuad &quad) {
+  global_render_kernels.draw_textured_quad(buffer, quad);
+}
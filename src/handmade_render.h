@@ -0,0 +1,57 @@
+#pragma once
+
+#include "handmade.h"
+
+#include <cstdint>
+
+/*
+ * NOTE: Pixel kernels are picked once at startup based on what the CPU
+ * supports. The scalar versions are the reference every SIMD version must
+ * match bit for bit.
+ */
+
+enum class RenderKernelSet {
+  Scalar,
+  SSE2,
+  AVX2,
+};
+
+typedef void RenderWeirdGradientKernel(const GameOffscreenBuffer &buffer,
+                                       const int blue_offset,
+                                       const int green_offset);
+typedef void ClearBufferKernel(const GameOffscreenBuffer &buffer,
+                               const uint32_t color);
+// NOTE: Blends a buffer.width x buffer.height block of premultiplied alpha
+// source pixels over the buffer
+typedef void BlendBitmapKernel(const GameOffscreenBuffer &buffer,
+                               const uint32_t *source,
+                               const uint32_t source_pitch);
+
+/*
+ * NOTE: A bitmap mapped onto the parallelogram spanned by x_axis and y_axis
+ * from origin, in pixels relative to the top left of the buffer it is drawn
+ * into. The bitmap is premultiplied alpha sRGB, at least 2x2 pixels.
+ */
+struct TexturedQuad {
+  float origin_x;
+  float origin_y;
+  float x_axis_x;
+  float x_axis_y;
+  float y_axis_x;
+  float y_axis_y;
+  const LoadedBitmap *bitmap;
+};
+
+// NOTE: Bilinearly samples the quad's bitmap for every pixel of the buffer the
+// quad covers and blends it over the buffer in linear space
+typedef void DrawTexturedQuadKernel(const GameOffscreenBuffer &buffer,
+                                    const TexturedQuad &quad);
+
+struct RenderKernels {
+  RenderKernelSet kernel_set;
+  RenderWeirdGradientKernel *render_weird_gradient;
+  ClearBufferKernel *clear_buffer;
+  BlendBitmapKernel *blend_bitmap;
+  DrawTexturedQuadKernel *draw_textured_quad;
+};
+
@@ -0,0 +1,420 @@
+#include "handmade_render_group.h"
+#include "handmade_render.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static inline Rectangle2i intersect(const Rectangle2i a, const Rectangle2i b) {
+  Rectangle2i result;
+  result.min_x = std::max(a.min_x, b.min_x);
+  result.min_y = std::max(a.min_y, b.min_y);
+  result.max_x = std::min(a.max_x, b.max_x);
+  result.max_y = std::min(a.max_y, b.max_y);
+  return result;
+}
+
+static inline bool has_area(const Rectangle2i rect) {
+  return rect.min_x < rect.max_x && rect.min_y < rect.max_y;
+}
+
+/*
+ * NOTE: Returns a buffer covering only `rect` (which must lie inside
+ * `buffer`), sharing its memory and pitch
+ */
+static GameOffscreenBuffer get_sub_buffer(const GameOffscreenBuffer &buffer,
+                                          const Rectangle2i rect) {
+  GameOffscreenBuffer result;
+  result.memory = (uint8_t *)buffer.memory + (uint32_t)rect.min_y * buffer.pitch +
+                  (uint32_t)rect.min_x * sizeof(uint32_t);
+  result.width = (uint32_t)(rect.max_x - rect.min_x);
+  result.height = (uint32_t)(rect.max_y - rect.min_y);
+  result.pitch = buffer.pitch;
+  return result;
+}
+
+/*
+ * NOTE: Recording
+ */
+
+static RenderGroup *allocate_render_group(MemoryArena *arena,
+                                          const uint32_t max_push_buffer_size) {
+  RenderGroup *result = push_struct<RenderGroup>(arena);
+
+  // NOTE: Enough sort entries for one per entry as long as the average entry
+  // is at least 16 bytes
+  result->max_sort_entry_count = max_push_buffer_size / 16;
+  result->sort_entry_count = 0;
+  result->sort_entries =
+      push_array<RenderSortEntry>(arena, result->max_sort_entry_count);
+
+  result->max_push_buffer_size = max_push_buffer_size;
+  result->push_buffer_size = 0;
+  result->push_buffer_base =
+      (uint8_t *)push_size(arena, max_push_buffer_size, 16);
+
+  return result;
+}
+
+static void *push_render_element(RenderGroup *group,
+                                 const RenderEntryType type,
+                                 const uint32_t size, const uint32_t sort_key) {
+  // NOTE: Every entry stays 8 byte aligned so bodies can hold pointers
+  const uint32_t entry_size =
+      (uint32_t)((sizeof(RenderEntryHeader) + size + 7) & ~7u);
+
+  void *result = NULL;
+  if (group->push_buffer_size + entry_size <= group->max_push_buffer_size &&
+      group->sort_entry_count < group->max_sort_entry_count) {
+    RenderEntryHeader *header =
+        (RenderEntryHeader *)(group->push_buffer_base +
+                              group->push_buffer_size);
+    header->type = type;
+    header->size = size;
+
+    RenderSortEntry &sort_entry = group->sort_entries[group->sort_entry_count];
+    sort_entry.key = ((uint64_t)sort_key << 32) | group->sort_entry_count;
+    sort_entry.push_buffer_offset = group->push_buffer_size;
+
+    ++group->sort_entry_count;
+    group->push_buffer_size += entry_size;
+    result = header + 1;
+  } else {
+    // TODO: Log that the render group is full. The draw is dropped.
+    ASSERT(!"Render group is full");
+  }
+
+  return result;
+}
+
+static void push_clear(RenderGroup *group, const uint32_t sort_key,
+                       const uint32_t color) {
+  RenderEntryClear *entry = (RenderEntryClear *)push_render_element(
+      group, RenderEntryType::Clear, sizeof(RenderEntryClear), sort_key);
+  if (entry) {
+    entry->color = color;
+  }
+}
+
+static void push_rectangle(RenderGroup *group, const uint32_t sort_key,
+                           const Rectangle2i rect, const uint32_t color) {
+  RenderEntryRectangle *entry =
+      (RenderEntryRectangle *)push_render_element(
+          group, RenderEntryType::Rectangle, sizeof(RenderEntryRectangle),
+          sort_key);
+  if (entry) {
+    entry->rect = rect;
+    entry->color = color;
+  }
+}
+
+static void push_bitmap(RenderGroup *group, const uint32_t sort_key,
+                        const LoadedBitmap *bitmap, const int32_t x,
+                        const int32_t y) {
+  RenderEntryBitmap *entry = (RenderEntryBitmap *)push_render_element(
+      group, RenderEntryType::Bitmap, sizeof(RenderEntryBitmap), sort_key);
+  if (entry) {
+    entry->bitmap = bitmap;
+    entry->x = x;
+    entry->y = y;
+  }
+}
+
+static void push_weird_gradient(RenderGroup *group, const uint32_t sort_key,
+                                const int32_t blue_offset,
+                                const int32_t green_offset) {
+  RenderEntryWeirdGradient *entry =
+      (RenderEntryWeirdGradient *)push_render_element(
+          group, RenderEntryType::WeirdGradient,
+          sizeof(RenderEntryWeirdGradient), sort_key);
+  if (entry) {
+    entry->blue_offset = blue_offset;
+    entry->green_offset = green_offset;
+  }
+}
+
+static void push_textured_quad(RenderGroup *group, const uint32_t sort_key,
+                               const LoadedBitmap *bitmap,
+                               const float origin_x, const float origin_y,
+                               const float x_axis_x, const float x_axis_y,
+                               const float y_axis_x, const float y_axis_y) {
+  RenderEntryTexturedQuad *entry =
+      (RenderEntryTexturedQuad *)push_render_element(
+          group, RenderEntryType::TexturedQuad,
+          sizeof(RenderEntryTexturedQuad), sort_key);
+  if (entry) {
+    entry->bitmap = bitmap;
+    entry->origin_x = origin_x;
+    entry->origin_y = origin_y;
+    entry->x_axis_x = x_axis_x;
+    entry->x_axis_y = x_axis_y;
+    entry->y_axis_x = y_axis_x;
+    entry->y_axis_y = y_axis_y;
+  }
+}
+
+/*
+ * NOTE: Execution
+ */
+
+static void sort_render_group(RenderGroup *group) {
+  std::sort(group->sort_entries,
+            group->sort_entries + group->sort_entry_count,
+            [](const RenderSortEntry &a, const RenderSortEntry &b) {
+              return a.key < b.key;
+            });
+}
+
+static void draw_bitmap(const GameOffscreenBuffer &buffer,
+                        const Rectangle2i clip_rect, const LoadedBitmap &bitmap,
+                        const int32_t x, const int32_t y) {
+  const Rectangle2i bitmap_rect{x, y, x + (int32_t)bitmap.width,
+                                y + (int32_t)bitmap.height};
+  const Rectangle2i fill_rect = intersect(clip_rect, bitmap_rect);
+  if (!has_area(fill_rect)) {
+    return;
+  }
+
+  const uint32_t *source =
+      (const uint32_t *)((const uint8_t *)bitmap.memory +
+                         (uint32_t)(fill_rect.min_y - y) * bitmap.pitch +
+                         (uint32_t)(fill_rect.min_x - x) * sizeof(uint32_t));
+  blend_bitmap(get_sub_buffer(buffer, fill_rect), source, bitmap.pitch);
+}
+
+static Rectangle2i
+get_textured_quad_rect(const RenderEntryTexturedQuad &entry) {
+  const float corners_x[4] = {
+      entry.origin_x, entry.origin_x + entry.x_axis_x,
+      entry.origin_x + entry.y_axis_x,
+      entry.origin_x + entry.x_axis_x + entry.y_axis_x};
+  const float corners_y[4] = {
+      entry.origin_y, entry.origin_y + entry.x_axis_y,
+      entry.origin_y + entry.y_axis_y,
+      entry.origin_y + entry.x_axis_y + entry.y_axis_y};
+  return Rectangle2i{
+      (int32_t)std::floor(*std::min_element(corners_x, corners_x + 4)),
+      (int32_t)std::floor(*std::min_element(corners_y, corners_y + 4)),
+      (int32_t)std::ceil(*std::max_element(corners_x, corners_x + 4)),
+      (int32_t)std::ceil(*std::max_element(corners_y, corners_y + 4))};
+}
+
+/*
+ * NOTE: Only the pixels inside the quad's bounding box (and the clip rect)
+ * are handed to the kernel
+ */
+static void draw_textured_quad(const GameOffscreenBuffer &buffer,
+                               const Rectangle2i clip_rect,
+                               const RenderEntryTexturedQuad &entry) {
+  const Rectangle2i fill_rect =
+      intersect(clip_rect, get_textured_quad_rect(entry));
+  if (!has_area(fill_rect)) {
+    return;
+  }
+
+  TIMED_BLOCK(__func__, (uint32_t)(fill_rect.max_x - fill_rect.min_x) *
+                            (uint32_t)(fill_rect.max_y - fill_rect.min_y));
+  const TexturedQuad quad{entry.origin_x - (float)fill_rect.min_x,
+                          entry.origin_y - (float)fill_rect.min_y,
+                          entry.x_axis_x,
+                          entry.x_axis_y,
+                          entry.y_axis_x,
+                          entry.y_axis_y,
+                          entry.bitmap};
+  draw_textured_quad(get_sub_buffer(buffer, fill_rect), quad);
+}
+
+/*
+ * NOTE: Draws every entry of an already sorted group, touching only the
+ * pixels inside `clip_rect`. Entries that don't overlap it are culled.
+ */
+static void render_group_to_output(const RenderGroup *group,
+                                   const GameOffscreenBuffer &buffer,
+                                   const Rectangle2i clip_rect) {
+  TIMED_BLOCK(__func__, (uint32_t)(clip_rect.max_x - clip_rect.min_x) *
+                            (uint32_t)(clip_rect.max_y - clip_rect.min_y));
+  for (uint32_t sort_index = 0; sort_index < group->sort_entry_count;
+       ++sort_index) {
+    const RenderSortEntry &sort_entry = group->sort_entries[sort_index];
+    const RenderEntryHeader *header =
+        (const RenderEntryHeader *)(group->push_buffer_base +
+                                    sort_entry.push_buffer_offset);
+    const void *data = header + 1;
+
+    switch (header->type) {
+    case RenderEntryType::Clear: {
+      const RenderEntryClear *entry = (const RenderEntryClear *)data;
+      clear_buffer(get_sub_buffer(buffer, clip_rect), entry->color);
+    } break;
+    case RenderEntryType::Rectangle: {
+      const RenderEntryRectangle *entry = (const RenderEntryRectangle *)data;
+      const Rectangle2i fill_rect = intersect(clip_rect, entry->rect);
+      if (has_area(fill_rect)) {
+        clear_buffer(get_sub_buffer(buffer, fill_rect), entry->color);
+      }
+    } break;
+    case RenderEntryType::Bitmap: {
+      const RenderEntryBitmap *entry = (const RenderEntryBitmap *)data;
+      draw_bitmap(buffer, clip_rect, *entry->bitmap, entry->x, entry->y);
+    } break;
+    case RenderEntryType::WeirdGradient: {
+      const RenderEntryWeirdGradient *entry =
+          (const RenderEntryWeirdGradient *)data;
+      render_weird_gradient(get_sub_buffer(buffer, clip_rect),
+                            entry->blue_offset + clip_rect.min_x,
+                            entry->green_offset + clip_rect.min_y);
+    } break;
+    case RenderEntryType::TexturedQuad: {
+      const RenderEntryTexturedQuad *entry =
+          (const RenderEntryTexturedQuad *)data;
+      draw_textured_quad(buffer, clip_rect, *entry);
+    } break;
+    }
+  }
+}
+
+/*
+ * NOTE: The pixels an entry may touch, entries that fill the whole clip rect
+ * return `everything`
+ */
+static Rectangle2i get_render_entry_bounds(const RenderEntryHeader *header,
+                                           const Rectangle2i everything) {
+  const void *data = header + 1;
+  Rectangle2i result = everything;
+  switch (header->type) {
+  case RenderEntryType::Clear:
+  case RenderEntryType::WeirdGradient: {
+  } break;
+  case RenderEntryType::Rectangle: {
+    result = ((const RenderEntryRectangle *)data)->rect;
+  } break;
+  case RenderEntryType::Bitmap: {
+    const RenderEntryBitmap *entry = (const RenderEntryBitmap *)data;
+    result = Rectangle2i{entry->x, entry->y,
+                         entry->x + (int32_t)entry->bitmap->width,
+                         entry->y + (int32_t)entry->bitmap->height};
+  } break;
+  case RenderEntryType::TexturedQuad: {
+    result = get_textured_quad_rect(*(const RenderEntryTexturedQuad *)data);
+  } break;
+  }
+
+  return result;
+}
+
+// NOTE: 64 bit FNV-1a
+static inline uint64_t hash_bytes(uint64_t hash, const void *data,
+                                  const uint32_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (uint32_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+/*
+ * NOTE: Hashes, in draw order, every entry that overlaps `clip_rect`. Two
+ * tiles with the same hash are drawn exactly the same, as long as the
+ * bitmaps the entries point to don't change while they're in use.
+ */
+static uint64_t hash_render_group_tile(const RenderGroup *group,
+                                       const Rectangle2i clip_rect) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (uint32_t sort_index = 0; sort_index < group->sort_entry_count;
+       ++sort_index) {
+    const RenderEntryHeader *header =
+        (const RenderEntryHeader *)(group->push_buffer_base +
+                                    group->sort_entries[sort_index]
+                                        .push_buffer_offset);
+    if (has_area(
+            intersect(clip_rect, get_render_entry_bounds(header, clip_rect)))) {
+      hash = hash_bytes(hash, header, sizeof(RenderEntryHeader) + header->size);
+    }
+  }
+  return hash;
+}
+
+static void do_tile_render_work(PlatformWorkQueue *, void *data) {
+  const TileRenderWork *work = (const TileRenderWork *)data;
+  render_group_to_output(work->render_group, work->buffer, work->clip_rect);
+}
+
+/*
+ * NOTE: Sorts the group once, then executes it on the platform's render
+ * queue, one entry per tile whose contents changed since the previous frame.
+ * Returns once every tile is done, with the tiles that were drawn in
+ * memory.dirty_rects.
+ */
+static void tiled_render_group_to_output(GameMemory &memory,
+                                         RenderGroup *group,
+                                         const GameOffscreenBuffer &buffer,
+                                         RenderTileCache *cache) {
+  TIMED_FUNCTION();
+  static_assert(MAX_RENDER_TILE_COUNT <= MAX_DIRTY_RECT_COUNT);
+  sort_render_group(group);
+
+  GameDirtyRects &dirty_rects = memory.dirty_rects;
+  if (!memory.high_priority_queue) {
+    render_group_to_output(
+        group, buffer,
+        Rectangle2i{0, 0, (int32_t)buffer.width, (int32_t)buffer.height});
+    dirty_rects.count = 1;
+    dirty_rects.rects[0] = GameDirtyRect{0, 0, buffer.width, buffer.height};
+    cache->is_valid = false;
+    return;
+  }
+
+  const uint32_t tile_count_x =
+      (buffer.width + RENDER_TILE_WIDTH - 1) / RENDER_TILE_WIDTH;
+  // NOTE: Very large buffers get taller tiles rather than overflowing the
+  // queue
+  uint32_t tile_height = RENDER_TILE_HEIGHT;
+  uint32_t tile_count_y = (buffer.height + tile_height - 1) / tile_height;
+  while (tile_count_x * tile_count_y > MAX_RENDER_TILE_COUNT) {
+    tile_height *= 2;
+    tile_count_y = (buffer.height + tile_height - 1) / tile_height;
+  }
+
+  const bool cache_is_valid =
+      cache->is_valid && !memory.backbuffer_lost &&
+      cache->buffer.memory == buffer.memory &&
+      cache->buffer.width == buffer.width &&
+      cache->buffer.height == buffer.height &&
+      cache->buffer.pitch == buffer.pitch && cache->tile_height == tile_height;
+  cache->is_valid = true;
+  cache->buffer = buffer;
+  cache->tile_height = tile_height;
+
+  std::array<TileRenderWork, MAX_RENDER_TILE_COUNT> work_array;
+  uint32_t work_count = 0;
+  dirty_rects.count = 0;
+  for (uint32_t tile_y = 0; tile_y < tile_count_y; ++tile_y) {
+    for (uint32_t tile_x = 0; tile_x < tile_count_x; ++tile_x) {
+      const uint32_t min_x = tile_x * RENDER_TILE_WIDTH;
+      const uint32_t min_y = tile_y * tile_height;
+      const uint32_t max_x = std::min(min_x + RENDER_TILE_WIDTH, buffer.width);
+      const uint32_t max_y = std::min(min_y + tile_height, buffer.height);
+      const Rectangle2i clip_rect{(int32_t)min_x, (int32_t)min_y,
+                                  (int32_t)max_x, (int32_t)max_y};
+
+      uint64_t &tile_hash = cache->tile_hashes[tile_y * tile_count_x + tile_x];
+      const uint64_t hash = hash_render_group_tile(group, clip_rect);
+      if (cache_is_valid && hash == tile_hash) {
+        continue;
+      }
+      tile_hash = hash;
+
+      TileRenderWork &work = work_array[work_count++];
+      work.render_group = group;
+      work.buffer = buffer;
+      work.clip_rect = clip_rect;
+      dirty_rects.rects[dirty_rects.count++] =
+          GameDirtyRect{min_x, min_y, max_x, max_y};
+
+      memory.platform_add_entry(memory.high_priority_queue,
+                                do_tile_render_work, &work);
+    }
+  }
+
+  memory.platform_complete_all_work(memory.high_priority_queue);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "handmade.h"
+
+#include <cstdint>
+
+/*
+ * NOTE: The game doesn't draw straight into pixels. It pushes compact render
+ * entries into a RenderGroup, which is then sorted by sort key (submission
+ * order breaks ties) and executed tile by tile against the backbuffer.
+ */
+
+struct Rectangle2i {
+  int32_t min_x;
+  int32_t min_y;
+  int32_t max_x;
+  int32_t max_y;
+};
+
+struct LoadedBitmap {
+  uint32_t width;
+  uint32_t height;
+  uint32_t pitch;
+  uint32_t *memory;
+};
+
+enum class RenderEntryType : uint32_t {
+  Clear,
+  Rectangle,
+  Bitmap,
+  WeirdGradient,
+  TexturedQuad,
+};
+
+struct RenderEntryHeader {
+  RenderEntryType type;
+  // NOTE: Of the body that follows, without padding
+  uint32_t size;
+};
+
+struct RenderEntryClear {
+  uint32_t color;
+};
+
+struct RenderEntryRectangle {
+  Rectangle2i rect;
+  uint32_t color;
+};
+
+struct RenderEntryBitmap {
+  const LoadedBitmap *bitmap;
+  int32_t x;
+  int32_t y;
+};
+
+struct RenderEntryWeirdGradient {
+  int32_t blue_offset;
+  int32_t green_offset;
+};
+
+// NOTE: The bitmap mapped onto the parallelogram spanned by x_axis and y_axis
+// from origin, in buffer pixels
+struct RenderEntryTexturedQuad {
+  const LoadedBitmap *bitmap;
+  float origin_x;
+  float origin_y;
+  float x_axis_x;
+  float x_axis_y;
+  float y_axis_x;
+  float y_axis_y;
+};
+
+struct RenderSortEntry {
+  // NOTE: Sort key in the high 32 bits, push index in the low ones, so equal
+  // keys keep the order they were pushed in
+  uint64_t key;
+  uint32_t push_buffer_offset;
+};
+
+struct RenderGroup {
+  uint32_t max_push_buffer_size;
+  uint32_t push_buffer_size;
+  uint8_t *push_buffer_base;
+
+  uint32_t max_sort_entry_count;
+  uint32_t sort_entry_count;
+  RenderSortEntry *sort_entries;
+};
+
+/*
+ * NOTE: Tiles are 256x64 pixels (64 KB), small enough to stay in a core's L2
+ * while it's being filled. The width is a multiple of 16 pixels so, as long
+ * as the buffer's memory and pitch are cache line aligned, no two tiles share
+ * a cache line.
+ */
+constexpr uint32_t RENDER_TILE_WIDTH = 256;
+constexpr uint32_t RENDER_TILE_HEIGHT = 64;
+constexpr uint32_t MAX_RENDER_TILE_COUNT = 1020;
+
+struct TileRenderWork {
+  const RenderGroup *render_group;
+  GameOffscreenBuffer buffer;
+  Rectangle2i clip_rect;
+};
+
+/*
+ * NOTE: A hash of every entry that touched each tile in the previous frame.
+ * A tile whose entries hash the same this frame would come out the same, so
+ * it isn't drawn again. Only valid for a backbuffer with the same memory,
+ * size and tile layout, anything else redraws every tile.
+ */
+struct RenderTileCache {
+  bool is_valid;
+  GameOffscreenBuffer buffer;
+  uint32_t tile_height;
+  std::array<uint64_t, MAX_RENDER_TILE_COUNT> tile_hashes;
+};
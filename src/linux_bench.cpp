@@ -0,0 +1,632 @@
+/*
+ * NOTE: Microbenchmarks for the game layer's kernels and the platform's input
+ * handling. Every benchmark is run warmup_count times untimed, then
+ * sample_count times timed one run at a time with the TSC, and reports the
+ * min, median and p99 run divided by the number of items (pixels, samples,
+ * events) a run processes. The TSC ticks at a fixed rate rather than with
+ * the core's clock, so these are reference cycles.
+ *
+ * With --train it instead plays scripted frames through a game library, see
+ * linux_bench_train. It is built without HANDMADE_INTERNAL, like release
+ * builds of the game library, so the GameMemory it hands them matches.
+ */
+
+#include "linux_bench.h"
+#include "handmade.h"
+
+#include "handmade.cpp"
+#include "linux_common.cpp"
+#include "linux_input.cpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <linux/input.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+static void linux_bench_print_usage(const char *program_name) {
+  fprintf(stderr,
+          "Usage: %s [--warmup N] [--samples N] [--filter NAME] "
+          "[--hugetlb] [--thp] [--prefault]\n"
+          "       %s --train LIBRARY [--frames N]\n",
+          program_name, program_name);
+}
+
+static bool linux_bench_parse_options(int argc, char **argv,
+                                      LinuxBenchOptions &options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (strcmp(arg, "--warmup") == 0 && has_value) {
+      options.warmup_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--samples") == 0 && has_value) {
+      options.sample_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--filter") == 0 && has_value) {
+      options.filter = argv[++i];
+    } else if (strcmp(arg, "--train") == 0 && has_value) {
+      options.train_library_path = argv[++i];
+    } else if (strcmp(arg, "--frames") == 0 && has_value) {
+      options.train_frame_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (linux_parse_memory_option(arg, options.memory)) {
+    } else {
+      return false;
+    }
+  }
+
+  return options.sample_count > 0 &&
+         options.sample_count <= LINUX_BENCH_MAX_SAMPLE_COUNT &&
+         options.train_frame_count > 0;
+}
+
+// NOTE: TSC ticks per nanosecond, measured against the wall clock
+static double linux_bench_measure_tsc_frequency() {
+  const timespec start = linux_get_wall_clock();
+  const uint64_t start_clock = __rdtsc();
+  timespec end = start;
+  while (linux_get_nanoseconds_elapsed(start, end) < 100000000) {
+    end = linux_get_wall_clock();
+  }
+  return (double)(__rdtsc() - start_clock) /
+         (double)linux_get_nanoseconds_elapsed(start, end);
+}
+
+static void linux_run_bench(const LinuxBenchOptions &options,
+                            const double ticks_per_nanosecond,
+                            const char *name, const uint64_t item_count,
+                            LinuxBenchFunction *function, void *data) {
+  if (options.filter && !strstr(name, options.filter)) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < options.warmup_count; ++i) {
+    function(data);
+  }
+
+  static std::array<uint64_t, LINUX_BENCH_MAX_SAMPLE_COUNT> samples;
+  for (uint32_t i = 0; i < options.sample_count; ++i) {
+    // NOTE: Keeps the TSC reads from being reordered into the run
+    _mm_lfence();
+    const uint64_t start = __rdtsc();
+    _mm_lfence();
+    function(data);
+    _mm_lfence();
+    samples[i] = __rdtsc() - start;
+  }
+  std::sort(samples.begin(), samples.begin() + options.sample_count);
+
+  const uint64_t median = samples[options.sample_count / 2];
+  const uint64_t p99 = samples[((uint64_t)options.sample_count * 99) / 100];
+  const double items = (double)item_count;
+  fprintf(stdout, "%-44s %9lu %9.2f %9.2f %9.2f %10.2f\n", name, item_count,
+          (double)samples[0] / items, (double)median / items,
+          (double)p99 / items,
+          (double)median / ticks_per_nanosecond / 1000.0);
+}
+
+/*
+ * NOTE: Render kernels
+ */
+
+struct LinuxBenchRenderData {
+  RenderKernels kernels;
+  GameOffscreenBuffer buffer;
+  const uint32_t *source;
+  uint32_t source_pitch;
+  TexturedQuad quad;
+};
+
+static void linux_bench_render_weird_gradient(void *data) {
+  const LinuxBenchRenderData *bench = (const LinuxBenchRenderData *)data;
+  bench->kernels.render_weird_gradient(bench->buffer, 3, 7);
+}
+
+static void linux_bench_clear_buffer(void *data) {
+  const LinuxBenchRenderData *bench = (const LinuxBenchRenderData *)data;
+  bench->kernels.clear_buffer(bench->buffer, 0xFF336699);
+}
+
+static void linux_bench_blend_bitmap(void *data) {
+  const LinuxBenchRenderData *bench = (const LinuxBenchRenderData *)data;
+  bench->kernels.blend_bitmap(bench->buffer, bench->source,
+                              bench->source_pitch);
+}
+
+static void linux_bench_draw_textured_quad(void *data) {
+  const LinuxBenchRenderData *bench = (const LinuxBenchRenderData *)data;
+  bench->kernels.draw_textured_quad(bench->buffer, bench->quad);
+}
+
+/*
+ * NOTE: Every kernel set the CPU supports, at sizes from a small window to
+ * 4K. The source is premultiplied with every kind of alpha, in runs, so the
+ * blends take both their shortcuts and their slow paths.
+ */
+static void linux_bench_render(const LinuxBenchOptions &options,
+                               const double ticks_per_nanosecond) {
+  constexpr uint32_t max_width = 3840;
+  constexpr uint32_t max_height = 2160;
+  constexpr uint32_t pitch = max_width * sizeof(uint32_t);
+  constexpr size_t buffer_size = (size_t)pitch * max_height;
+  uint32_t *pixels = (uint32_t *)mmap(NULL, 2 * buffer_size,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pixels == MAP_FAILED) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    return;
+  }
+  uint32_t *source = pixels + buffer_size / sizeof(uint32_t);
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < buffer_size / sizeof(uint32_t); ++i) {
+    seed = seed * 1664525 + 1013904223;
+    uint32_t alpha = seed >> 24;
+    if ((i / 64) % 3 == 1) {
+      alpha = 255;
+    } else if ((i / 64) % 3 == 2) {
+      alpha = 0;
+    }
+    uint32_t pixel = alpha << 24;
+    for (uint32_t shift = 0; shift < 24; shift += 8) {
+      pixel |= divide_by_255(((seed >> shift) & 0xFF) * alpha) << shift;
+    }
+    source[i] = pixel;
+  }
+  const LoadedBitmap bitmap{256, 256, pitch, source};
+
+  struct KernelSetInfo {
+    RenderKernelSet kernel_set;
+    const char *name;
+    bool is_supported;
+  };
+  const KernelSetInfo kernel_sets[] = {
+      {RenderKernelSet::Scalar, "scalar", true},
+      {RenderKernelSet::SSE2, "sse2", cpu_supports_sse2()},
+      {RenderKernelSet::AVX2, "avx2", cpu_supports_avx2()},
+  };
+  const uint32_t sizes[][2] = {
+      {320, 180}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+
+  struct KernelInfo {
+    const char *name;
+    LinuxBenchFunction *function;
+  };
+  const KernelInfo kernels[] = {
+      {"render_weird_gradient", linux_bench_render_weird_gradient},
+      {"clear_buffer", linux_bench_clear_buffer},
+      {"blend_bitmap", linux_bench_blend_bitmap},
+      {"draw_textured_quad", linux_bench_draw_textured_quad},
+  };
+
+  for (const KernelInfo &kernel : kernels) {
+    for (const KernelSetInfo &kernel_set : kernel_sets) {
+      if (!kernel_set.is_supported) {
+        continue;
+      }
+      for (const uint32_t *size : sizes) {
+        const float width = (float)size[0];
+        const float height = (float)size[1];
+        // NOTE: Turned a bit and just inside the buffer, so most pixels are
+        // drawn and the edges cross the SIMD blocks
+        const float cos_angle = cosf(0.1f) * 0.9f;
+        const float sin_angle = sinf(0.1f) * 0.9f;
+        LinuxBenchRenderData data{
+            get_render_kernels(kernel_set.kernel_set),
+            GameOffscreenBuffer{pixels, size[0], size[1], pitch},
+            source,
+            pitch,
+            TexturedQuad{width * 0.5f - (width * cos_angle -
+                                         height * sin_angle) * 0.5f,
+                         height * 0.5f - (width * sin_angle +
+                                          height * cos_angle) * 0.5f,
+                         width * cos_angle, width * sin_angle,
+                         -height * sin_angle, height * cos_angle, &bitmap}};
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s/%s/%ux%u", kernel.name,
+                 kernel_set.name, size[0], size[1]);
+        linux_run_bench(options, ticks_per_nanosecond, name,
+                        (uint64_t)size[0] * size[1], kernel.function, &data);
+      }
+    }
+  }
+
+  munmap(pixels, 2 * buffer_size);
+}
+
+/*
+ * NOTE: Mixer
+ */
+
+constexpr uint32_t LINUX_BENCH_VOICE_COUNT = 8;
+
+struct LinuxBenchAudioData {
+  AudioState audio_state;
+  // NOTE: If set, voices play it resampled, otherwise they're tones
+  const LoadedSound *sound;
+  GameSoundOutputBuffer sound_buffer;
+};
+
+static void linux_bench_output_playing_sounds(void *data) {
+  LinuxBenchAudioData *bench = (LinuxBenchAudioData *)data;
+  // NOTE: Sounds that ran out are started over, so every run mixes as many
+  // voices
+  if (bench->sound) {
+    uint32_t playing_count = 0;
+    for (const PlayingSound &sound : bench->audio_state.playing_sounds) {
+      playing_count += sound.is_playing ? 1 : 0;
+    }
+    for (; playing_count < LINUX_BENCH_VOICE_COUNT; ++playing_count) {
+      play_sound(&bench->audio_state, bench->sound, 0.1f, 0.0f);
+    }
+  }
+  output_playing_sounds(&bench->audio_state, bench->sound_buffer);
+}
+
+static void linux_bench_audio(const LinuxBenchOptions &options,
+                              const double ticks_per_nanosecond) {
+  constexpr uint32_t samples_per_second = 48000;
+  constexpr uint32_t max_sample_count = 4800;
+  static int16_t samples[max_sample_count * CHANNELS];
+
+  // NOTE: A second of stereo at 44.1kHz, so the voices also resample
+  constexpr uint32_t sound_sample_count = 44100;
+  static int16_t sound_samples[sound_sample_count * CHANNELS];
+  for (uint32_t i = 0; i < sound_sample_count; ++i) {
+    const float value = sinf(2.0f * PI_32 * 440.0f * (float)i / 44100.0f);
+    sound_samples[i * CHANNELS] = (int16_t)(value * 8000.0f);
+    sound_samples[i * CHANNELS + 1] = (int16_t)(value * -8000.0f);
+  }
+  const LoadedSound sound{CHANNELS, 44100, sound_sample_count, sound_samples};
+
+  const uint32_t sample_counts[] = {256, 1600, max_sample_count};
+  for (uint32_t use_sounds = 0; use_sounds < 2; ++use_sounds) {
+    for (const uint32_t sample_count : sample_counts) {
+      static LinuxBenchAudioData data;
+      initialize_audio_state(&data.audio_state, 1.0f);
+      data.sound = use_sounds ? &sound : NULL;
+      data.sound_buffer =
+          GameSoundOutputBuffer{samples_per_second, sample_count, samples};
+      if (!use_sounds) {
+        for (uint32_t i = 0; i < LINUX_BENCH_VOICE_COUNT; ++i) {
+          play_tone(&data.audio_state, 220.0f * (float)(i + 1), 0.1f,
+                    (float)i / LINUX_BENCH_VOICE_COUNT * 2.0f - 1.0f);
+        }
+      }
+
+      char name[64];
+      snprintf(name, sizeof(name), "output_playing_sounds/%u %s/%u",
+               LINUX_BENCH_VOICE_COUNT, use_sounds ? "sounds" : "tones",
+               sample_count);
+      linux_run_bench(options, ticks_per_nanosecond, name, sample_count,
+                      linux_bench_output_playing_sounds, &data);
+    }
+  }
+}
+
+/*
+ * NOTE: Input and presenting
+ */
+
+constexpr uint32_t LINUX_BENCH_INPUT_EVENT_COUNT = 4096;
+
+struct LinuxBenchInputData {
+  std::array<input_event, LINUX_BENCH_INPUT_EVENT_COUNT> events;
+  GameControllerInput old_controller;
+  GameControllerInput new_controller;
+  std::array<float, LINUX_BENCH_INPUT_EVENT_COUNT> stick_values;
+};
+
+// NOTE: The same six buttons per key event as linux_evdev_process_events
+static void linux_bench_evdev_digital_buttons(void *data) {
+  LinuxBenchInputData *bench = (LinuxBenchInputData *)data;
+  const GameControllerInput &old_controller = bench->old_controller;
+  GameControllerInput &new_controller = bench->new_controller;
+  for (const input_event &event : bench->events) {
+    linux_process_evdev_digital_button(event, &old_controller.action_left,
+                                       BTN_WEST, &new_controller.action_left);
+    linux_process_evdev_digital_button(event, &old_controller.action_right,
+                                       BTN_EAST,
+                                       &new_controller.action_right);
+    linux_process_evdev_digital_button(event, &old_controller.action_up,
+                                       BTN_NORTH, &new_controller.action_up);
+    linux_process_evdev_digital_button(event, &old_controller.action_down,
+                                       BTN_SOUTH,
+                                       &new_controller.action_down);
+    linux_process_evdev_digital_button(event, &old_controller.left_shoulder,
+                                       BTN_TL, &new_controller.left_shoulder);
+    linux_process_evdev_digital_button(event, &old_controller.right_shoulder,
+                                       BTN_TR,
+                                       &new_controller.right_shoulder);
+  }
+}
+
+static void linux_bench_evdev_stick_values(void *data) {
+  LinuxBenchInputData *bench = (LinuxBenchInputData *)data;
+  for (uint32_t i = 0; i < bench->events.size(); ++i) {
+    bench->stick_values[i] =
+        linux_process_evdev_stick_value(bench->events[i].value, 3);
+  }
+}
+
+static void linux_bench_keyboard_messages(void *data) {
+  LinuxBenchInputData *bench = (LinuxBenchInputData *)data;
+  GameButtonState &button = bench->new_controller.move_up;
+  for (uint32_t i = 0; i < bench->events.size(); ++i) {
+    linux_process_keyboard_message(&button, !button.ended_down);
+  }
+}
+
+struct LinuxBenchCoalesceData {
+  GameDirtyRects dirty_rects;
+  std::array<GameDirtyRect, LINUX_MAX_PRESENT_RECT_COUNT> present_rects;
+};
+
+static void linux_bench_coalesce_dirty_rects(void *data) {
+  LinuxBenchCoalesceData *bench = (LinuxBenchCoalesceData *)data;
+  linux_coalesce_dirty_rects(bench->dirty_rects, bench->present_rects.data(),
+                             LINUX_MAX_PRESENT_RECT_COUNT);
+}
+
+static void linux_bench_platform(const LinuxBenchOptions &options,
+                                 const double ticks_per_nanosecond) {
+  static LinuxBenchInputData input_data;
+  uint32_t seed = 1;
+  for (input_event &event : input_data.events) {
+    seed = seed * 1664525 + 1013904223;
+    const uint16_t codes[] = {BTN_WEST, BTN_EAST, BTN_NORTH,
+                              BTN_SOUTH, BTN_TL,   BTN_TR};
+    event = {};
+    event.type = EV_KEY;
+    event.code = codes[(seed >> 8) % 6];
+    event.value = (int32_t)((seed >> 16) & 0xFF);
+  }
+  linux_run_bench(options, ticks_per_nanosecond,
+                  "linux_process_evdev_digital_button/6 buttons",
+                  input_data.events.size(),
+                  linux_bench_evdev_digital_buttons, &input_data);
+  linux_run_bench(options, ticks_per_nanosecond,
+                  "linux_process_evdev_stick_value",
+                  input_data.events.size(), linux_bench_evdev_stick_values,
+                  &input_data);
+  linux_run_bench(options, ticks_per_nanosecond,
+                  "linux_process_keyboard_message", input_data.events.size(),
+                  linux_bench_keyboard_messages, &input_data);
+
+  // NOTE: The render tiles of a 1920x1080 frame, all of them as when
+  // everything moved, and every third one
+  static LinuxBenchCoalesceData coalesce_data;
+  for (uint32_t stride = 1; stride <= 3; stride += 2) {
+    GameDirtyRects &dirty_rects = coalesce_data.dirty_rects;
+    dirty_rects.count = 0;
+    uint32_t tile_index = 0;
+    for (uint32_t min_y = 0; min_y < 1080; min_y += RENDER_TILE_HEIGHT) {
+      for (uint32_t min_x = 0; min_x < 1920; min_x += RENDER_TILE_WIDTH) {
+        if (tile_index++ % stride == 0) {
+          dirty_rects.rects[dirty_rects.count++] = GameDirtyRect{
+              min_x, min_y, std::min(min_x + RENDER_TILE_WIDTH, 1920u),
+              std::min(min_y + RENDER_TILE_HEIGHT, 1080u)};
+        }
+      }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "linux_coalesce_dirty_rects/%s",
+             stride == 1 ? "all tiles" : "every third tile");
+    linux_run_bench(options, ticks_per_nanosecond, name, dirty_rects.count,
+                    linux_bench_coalesce_dirty_rects, &coalesce_data);
+  }
+}
+
+/*
+ * NOTE: Work queue
+ */
+
+constexpr uint32_t LINUX_BENCH_WORK_ENTRY_COUNT = 256;
+
+struct LinuxBenchWorkData {
+  PlatformWorkQueue *queue;
+  std::atomic<uint32_t> completed_count;
+};
+
+static void linux_bench_child_work(PlatformWorkQueue *, void *data) {
+  LinuxBenchWorkData *bench = (LinuxBenchWorkData *)data;
+  bench->completed_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void linux_bench_parent_work(PlatformWorkQueue *queue, void *data) {
+  LinuxBenchWorkData *bench = (LinuxBenchWorkData *)data;
+  linux_add_entry(queue, linux_bench_child_work, data);
+  bench->completed_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ * NOTE: Every entry adds another from inside itself, and complete_all_work
+ * has to have run both by the time it returns. Doubles as a check, a run
+ * that misses a child stops the benchmarks.
+ */
+static void linux_bench_nested_entries(void *data) {
+  LinuxBenchWorkData *bench = (LinuxBenchWorkData *)data;
+  bench->completed_count.store(0, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < LINUX_BENCH_WORK_ENTRY_COUNT; ++i) {
+    linux_add_entry(bench->queue, linux_bench_parent_work, bench);
+  }
+  linux_complete_all_work(bench->queue);
+
+  const uint32_t completed_count =
+      bench->completed_count.load(std::memory_order_relaxed);
+  if (completed_count != 2 * LINUX_BENCH_WORK_ENTRY_COUNT) {
+    fprintf(stderr, "complete_all_work returned after %u of %u entries\n",
+            completed_count, 2 * LINUX_BENCH_WORK_ENTRY_COUNT);
+    exit(1);
+  }
+}
+
+static void linux_bench_work_queue(const LinuxBenchOptions &options,
+                                   const double ticks_per_nanosecond) {
+  static LinuxWorkQueues work_queues;
+  linux_make_work_queues(&work_queues,
+                         linux_get_default_worker_thread_count());
+  static LinuxBenchWorkData data;
+  data.queue = &work_queues.high_priority;
+  linux_run_bench(options, ticks_per_nanosecond,
+                  "linux_complete_all_work/nested entries",
+                  2 * LINUX_BENCH_WORK_ENTRY_COUNT, linux_bench_nested_entries,
+                  &data);
+}
+
+/*
+ * NOTE: Training run for profile guided optimization
+ */
+
+static void linux_bench_set_button(GameButtonState *new_state,
+                                   const GameButtonState *old_state,
+                                   bool is_down) {
+  new_state->ended_down = is_down;
+  new_state->half_transition_count =
+      (old_state->ended_down != new_state->ended_down) ? 1 : 0;
+}
+
+/*
+ * NOTE: Plays scripted frames through the game library at
+ * options.train_library_path. Built with -fprofile-instr-generate, the
+ * library writes its profile when the process exits, and the release build
+ * of the library is then optimized with it (see build.sh). The profile has
+ * to come from the library's own translation unit, function names in it
+ * depend on the file they were compiled in. Half the frames are at
+ * 1920x1080 and half at 1280x720, and the input keeps the player moving and
+ * the sounds playing, so the profile sees a usual frame's mix of work.
+ */
+static int linux_bench_train(const LinuxBenchOptions &options) {
+  void *library = dlopen(options.train_library_path, RTLD_NOW | RTLD_LOCAL);
+  if (!library) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  GameUpdate *update = (GameUpdate *)dlsym(library, "game_update");
+  GameRender *render = (GameRender *)dlsym(library, "game_render");
+  GameGetSoundSamples *get_sound_samples =
+      (GameGetSoundSamples *)dlsym(library, "game_get_sound_samples");
+  if (!update || !render || !get_sound_samples) {
+    fprintf(stderr, "%s: missing the game's entry points\n",
+            options.train_library_path);
+    return 1;
+  }
+
+  constexpr uint32_t max_width = 1920;
+  constexpr uint32_t max_height = 1080;
+  constexpr uint32_t samples_per_frame = 48000 / 60;
+  static int16_t samples[samples_per_frame * CHANNELS];
+  void *backbuffer_memory =
+      mmap(NULL, (size_t)max_width * max_height * sizeof(uint32_t),
+           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  LinuxState linux_state = {};
+  GameMemory game_memory = {};
+  game_memory.permanent_storage_size = MEGABYTES(64);
+  game_memory.transient_storage_size = GIGABYTES(1);
+  if (backbuffer_memory == MAP_FAILED ||
+      !linux_allocate_game_memory(linux_state, game_memory, options.memory)) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    return 1;
+  }
+
+  static LinuxWorkQueues work_queues;
+  linux_make_work_queues(&work_queues, linux_get_default_worker_thread_count());
+  game_memory.high_priority_queue = &work_queues.high_priority;
+  game_memory.low_priority_queue = &work_queues.low_priority;
+  game_memory.platform_add_entry = linux_add_entry;
+  game_memory.platform_complete_all_work = linux_complete_all_work;
+  game_memory.platform_open_file = linux_open_file;
+  game_memory.platform_read_data_from_file = linux_read_data_from_file;
+  game_memory.platform_close_file = linux_close_file;
+
+  const GameSoundOutputBuffer sound_buffer{48000, samples_per_frame, samples};
+  GameInput input[2] = {};
+  GameInput *new_input = &input[0];
+  GameInput *old_input = &input[1];
+
+  // NOTE: Frames at 60Hz, and every hundredth one slow, so catching up is
+  // in the profile too
+  LinuxUpdateClock update_clock = {};
+  const timespec start = linux_get_wall_clock();
+  const LinuxPageFaultCounts start_page_faults = linux_get_page_fault_counts();
+  for (uint32_t frame_index = 0; frame_index < options.train_frame_count;
+       ++frame_index) {
+    const bool is_large = frame_index < options.train_frame_count / 2;
+    const uint32_t width = is_large ? max_width : 1280;
+    const uint32_t height = is_large ? max_height : 720;
+    const GameOffscreenBuffer buffer{backbuffer_memory, width, height,
+                                     width * (uint32_t)sizeof(uint32_t)};
+
+    GameControllerInput *keyboard = get_controller(new_input, 0);
+    const GameControllerInput *old_keyboard = get_controller(old_input, 0);
+    keyboard->is_connected = true;
+    const bool moving_right = (frame_index / 120) % 2 == 0;
+    linux_bench_set_button(&keyboard->move_right, &old_keyboard->move_right,
+                           moving_right);
+    linux_bench_set_button(&keyboard->move_left, &old_keyboard->move_left,
+                           !moving_right);
+    linux_bench_set_button(&keyboard->action_down,
+                           &old_keyboard->action_down,
+                           (frame_index / 30) % 2 == 0);
+
+    const uint32_t update_count = linux_advance_update_clock(
+        update_clock, frame_index % 100 == 99 ? 100000000 : 16666667);
+    for (uint32_t update_index = 0; update_index < update_count;
+         ++update_index) {
+      update(new_input, game_memory);
+      linux_clear_transitions(new_input);
+    }
+    render(buffer, game_memory, linux_get_update_alpha(update_clock));
+    get_sound_samples(game_memory, sound_buffer);
+    if (update_count > 0) {
+      std::swap(old_input, new_input);
+    }
+  }
+  const LinuxPageFaultCounts page_faults = linux_get_page_faults_elapsed(
+      start_page_faults, linux_get_page_fault_counts());
+
+  fprintf(stdout,
+          "trained on %u frames in %.3f s, %lu minor / %lu major page "
+          "faults\n",
+          options.train_frame_count,
+          (double)linux_get_seconds_elapsed(start, linux_get_wall_clock()),
+          page_faults.minor, page_faults.major);
+  linux_print_memory_usage(game_memory);
+
+  // NOTE: Not unloaded, the library writes its profile at exit
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  LinuxBenchOptions options{100, 1000, NULL, NULL, 600, {}};
+  if (!linux_bench_parse_options(argc, argv, options)) {
+    linux_bench_print_usage(argv[0]);
+    return 1;
+  }
+
+  if (options.train_library_path) {
+    return linux_bench_train(options);
+  }
+
+  init_render_kernels();
+  const double ticks_per_nanosecond = linux_bench_measure_tsc_frequency();
+  fprintf(stdout,
+          "tsc: %.3f GHz, %u warmup runs, %u timed runs each\n"
+          "%-44s %9s %9s %9s %9s %10s\n",
+          ticks_per_nanosecond, options.warmup_count, options.sample_count,
+          "", "items", "min", "median", "p99", "median us");
+  fprintf(stdout, "%-44s %9s %29s\n", "", "", "(cycles per item)");
+
+  linux_bench_render(options, ticks_per_nanosecond);
+  linux_bench_audio(options, ticks_per_nanosecond);
+  linux_bench_platform(options, ticks_per_nanosecond);
+  linux_bench_work_queue(options, ticks_per_nanosecond);
+
+  return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "linux_common.h"
+
+#include <cstdint>
+
+constexpr uint32_t LINUX_BENCH_MAX_SAMPLE_COUNT = 10000;
+
+struct LinuxBenchOptions {
+  uint32_t warmup_count;
+  uint32_t sample_count;
+  // NOTE: Only benchmarks whose name contains this are run, if set
+  const char *filter;
+  // NOTE: If set, frames are played through this game library instead of
+  // running the benchmarks
+  const char *train_library_path;
+  uint32_t train_frame_count;
+  LinuxMemoryOptions memory;
+};
+
+// NOTE: One run of the code being measured, `data` is the benchmark's state
+typedef void LinuxBenchFunction(void *data);
@@ -0,0 +1,758 @@
+/*
+ * NOTE: Platform code shared by every Linux entry point (X11 and headless).
+ * This is included in each entry point's translation unit (the headless one
+ * also has the game in it, the X11 one loads it as a library), so it must
+ * not pull in X11, ALSA or evdev.
+ */
+
+#include "linux_common.h"
+#include "handmade.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static constexpr uint32_t CHANNELS = 2;
+
+static timespec linux_get_wall_clock() {
+  timespec result;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &result);
+  return result;
+}
+
+static float linux_get_seconds_elapsed(timespec start, timespec end) {
+  float result =
+      (float)((end.tv_sec - start.tv_sec)) +
+      ((float)(end.tv_nsec - start.tv_nsec) / (1000.0f * 1000.0f * 1000.0f));
+  return result;
+}
+
+static uint64_t linux_get_nanoseconds_elapsed(timespec start, timespec end) {
+  uint64_t result = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ull +
+                    (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+  return result;
+}
+
+// NOTE: How many updates to run for a frame that took frame_nanoseconds
+static uint32_t linux_advance_update_clock(LinuxUpdateClock &clock,
+                                           const uint64_t frame_nanoseconds) {
+  clock.lag_nanoseconds += frame_nanoseconds;
+  uint64_t update_count = clock.lag_nanoseconds / LINUX_UPDATE_NANOSECONDS;
+  clock.lag_nanoseconds %= LINUX_UPDATE_NANOSECONDS;
+  if (update_count > LINUX_MAX_UPDATES_PER_FRAME) {
+    clock.dropped_update_count += update_count - LINUX_MAX_UPDATES_PER_FRAME;
+    update_count = LINUX_MAX_UPDATES_PER_FRAME;
+  }
+  return (uint32_t)update_count;
+}
+
+static float linux_get_update_alpha(const LinuxUpdateClock &clock) {
+  return (float)clock.lag_nanoseconds / (float)LINUX_UPDATE_NANOSECONDS;
+}
+
+// NOTE: So the updates after the first one in a frame don't see the same
+// presses again
+static void linux_clear_transitions(GameInput *input) {
+  for (GameControllerInput &controller : input->controllers) {
+    for (GameButtonState &button : controller.buttons) {
+      button.half_transition_count = 0;
+    }
+  }
+}
+
+static LinuxPageFaultCounts linux_get_page_fault_counts() {
+  LinuxPageFaultCounts result = {};
+  rusage usage;
+  // NOTE: RUSAGE_SELF so faults taken by the worker threads count too
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    result.minor = (uint64_t)usage.ru_minflt;
+    result.major = (uint64_t)usage.ru_majflt;
+  }
+  return result;
+}
+
+static LinuxPageFaultCounts
+linux_get_page_faults_elapsed(const LinuxPageFaultCounts start,
+                              const LinuxPageFaultCounts end) {
+  return LinuxPageFaultCounts{end.minor - start.minor,
+                              end.major - start.major};
+}
+
+/*
+ * NOTE: Returns true if `arg` was a memory option
+ */
+static bool linux_parse_memory_option(const char *arg,
+                                      LinuxMemoryOptions &options) {
+  bool result = true;
+  if (strcmp(arg, "--hugetlb") == 0) {
+    options.use_hugetlb = true;
+  } else if (strcmp(arg, "--thp") == 0) {
+    options.use_transparent_huge_pages = true;
+  } else if (strcmp(arg, "--prefault") == 0) {
+    options.prefault_permanent_storage = true;
+  } else {
+    result = false;
+  }
+  return result;
+}
+
+static void linux_prefault(void *memory, const uint64_t size) {
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(memory, (size_t)size, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif
+  // NOTE: Older kernels, touch every page by hand. The memory is still all
+  // zeroes so writing a zero doesn't change anything.
+  const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+  volatile uint8_t *bytes = (volatile uint8_t *)memory;
+  for (uint64_t offset = 0; offset < size; offset += page_size) {
+    bytes[offset] = 0;
+  }
+}
+
+static void *linux_map_game_memory(LinuxState &state, void *address,
+                                   const LinuxMemoryOptions &options) {
+  void *result = MAP_FAILED;
+  if (options.use_hugetlb) {
+    result = mmap(address, (size_t)state.total_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (result == MAP_FAILED) {
+      fprintf(stderr, "MAP_HUGETLB failed (%s), using regular pages\n",
+              strerror(errno));
+    } else {
+      // TODO: Snapshots of hugetlb memory, for now looped playback is off
+      return result;
+    }
+  }
+
+  result = mmap(address, (size_t)state.total_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if HANDMADE_INTERNAL
+  // NOTE: Only moved onto a memfd by the first snapshot, see
+  // linux_take_game_memory_snapshot
+  state.can_snapshot_game_memory = result != MAP_FAILED;
+#endif
+
+  if (result != MAP_FAILED && options.use_transparent_huge_pages) {
+    if (madvise(result, (size_t)state.total_size, MADV_HUGEPAGE) != 0) {
+      fprintf(stderr, "MADV_HUGEPAGE failed (%s)\n", strerror(errno));
+    }
+  }
+
+  return result;
+}
+
+static bool linux_allocate_game_memory(LinuxState &state,
+                                       GameMemory &game_memory,
+                                       const LinuxMemoryOptions &options) {
+#if HANDMADE_INTERNAL
+  void *address = (void *)TERABYTES(1);
+#else
+  void *address = 0;
+#endif
+
+  state.total_size =
+      game_memory.permanent_storage_size + game_memory.transient_storage_size;
+  state.snapshot_fd = -1;
+  state.can_snapshot_game_memory = false;
+  state.recording_fd = -1;
+  state.game_memory_block = linux_map_game_memory(state, address, options);
+  if (state.game_memory_block == MAP_FAILED) {
+    state.game_memory_block = NULL;
+    game_memory.permanent_storage = NULL;
+    game_memory.transient_storage = NULL;
+    return false;
+  }
+
+  game_memory.permanent_storage = state.game_memory_block;
+  game_memory.transient_storage = (uint8_t *)game_memory.permanent_storage +
+                                  game_memory.permanent_storage_size;
+
+  if (options.prefault_permanent_storage) {
+    linux_prefault(game_memory.permanent_storage,
+                   game_memory.permanent_storage_size);
+  }
+
+  return true;
+}
+
+static void linux_print_memory_usage(const GameMemory &game_memory) {
+  const GameMemoryUsage &usage = game_memory.usage;
+  fprintf(stdout, "permanent storage: %lu KB used of %lu KB (%.2f%%)\n",
+          usage.permanent_used / 1024,
+          game_memory.permanent_storage_size / 1024,
+          100.0 * (double)usage.permanent_used /
+              (double)game_memory.permanent_storage_size);
+  fprintf(stdout,
+          "transient storage: %lu KB high water mark of %lu KB (%.2f%%)\n",
+          usage.transient_high_water_mark / 1024,
+          game_memory.transient_storage_size / 1024,
+          100.0 * (double)usage.transient_high_water_mark /
+              (double)game_memory.transient_storage_size);
+}
+
+/*
+ * NOTE: Merges the game's dirty rects (tiles, in row major order) into fewer,
+ * larger ones: first runs of touching rects within a row, then runs with the
+ * same horizontal extent stacked on top of each other. If that still leaves
+ * more than max_count, they all become their bounding rect. Returns how many
+ * rects were written to `result`.
+ */
+static uint32_t linux_coalesce_dirty_rects(const GameDirtyRects &dirty_rects,
+                                           GameDirtyRect *result,
+                                           const uint32_t max_count) {
+  std::array<GameDirtyRect, MAX_DIRTY_RECT_COUNT> spans;
+  uint32_t span_count = 0;
+  for (uint32_t i = 0; i < dirty_rects.count; ++i) {
+    const GameDirtyRect &rect = dirty_rects.rects[i];
+    GameDirtyRect *last = span_count ? &spans[span_count - 1] : NULL;
+    if (last && last->max_x == rect.min_x && last->min_y == rect.min_y &&
+        last->max_y == rect.max_y) {
+      last->max_x = rect.max_x;
+    } else {
+      spans[span_count++] = rect;
+    }
+  }
+
+  uint32_t merged_count = 0;
+  for (uint32_t i = 0; i < span_count; ++i) {
+    const GameDirtyRect span = spans[i];
+    bool was_merged = false;
+    for (uint32_t j = 0; j < merged_count; ++j) {
+      GameDirtyRect &merged = spans[j];
+      if (merged.min_x == span.min_x && merged.max_x == span.max_x &&
+          merged.max_y == span.min_y) {
+        merged.max_y = span.max_y;
+        was_merged = true;
+        break;
+      }
+    }
+    if (!was_merged) {
+      spans[merged_count++] = span;
+    }
+  }
+
+  if (merged_count > max_count) {
+    GameDirtyRect bounds = spans[0];
+    for (uint32_t i = 1; i < merged_count; ++i) {
+      bounds.min_x = std::min(bounds.min_x, spans[i].min_x);
+      bounds.min_y = std::min(bounds.min_y, spans[i].min_y);
+      bounds.max_x = std::max(bounds.max_x, spans[i].max_x);
+      bounds.max_y = std::max(bounds.max_y, spans[i].max_y);
+    }
+    spans[0] = bounds;
+    merged_count = 1;
+  }
+
+  std::copy(spans.begin(), spans.begin() + merged_count, result);
+  return merged_count;
+}
+
+static void linux_log_file_error(const char *filename, const char *operation) {
+  fprintf(stderr, "%s: %s failed: %s\n", filename, operation, strerror(errno));
+}
+
+#if HANDMADE_INTERNAL
+static uint64_t linux_get_wall_clock_nanoseconds() {
+  const timespec now = linux_get_wall_clock();
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// NOTE: Mapped, so only the rings of threads that record something get pages
+static DebugTable *linux_allocate_debug_table() {
+  void *memory = mmap(NULL, sizeof(DebugTable), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    // TODO: Log, we are running without the profiler
+    return NULL;
+  }
+  DebugTable *result = (DebugTable *)memory;
+  result->base_clock = __rdtsc();
+  result->base_nanoseconds = linux_get_wall_clock_nanoseconds();
+  return result;
+}
+
+/*
+ * NOTE: Copies the thread's event at `index` out of its ring. Fails if the
+ * writer may have overwritten it, during the copy or before.
+ */
+static bool linux_read_debug_event(const DebugThread &thread,
+                                   const uint64_t index, DebugEvent &event) {
+  event = thread.events[index % DEBUG_EVENT_RING_CAPACITY];
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return thread.write_index.load(std::memory_order_relaxed) <
+         index + DEBUG_EVENT_RING_CAPACITY;
+}
+
+static DebugBlockStats &linux_get_debug_block_stats(DebugFrameStats &frame,
+                                                    const char *name,
+                                                    const uint32_t depth) {
+  for (uint32_t i = 0; i < frame.block_count; ++i) {
+    if (frame.blocks[i].name == name) {
+      return frame.blocks[i];
+    }
+  }
+  // NOTE: Past the limit, the remaining blocks are all tallied into the last
+  // one
+  if (frame.block_count < frame.blocks.size()) {
+    DebugBlockStats &result = frame.blocks[frame.block_count++];
+    result = DebugBlockStats{name, depth, 0, 0, 0, 0};
+    return result;
+  }
+  return frame.blocks[frame.blocks.size() - 1];
+}
+
+/*
+ * NOTE: Called by the platform at the end of every frame. Tallies the blocks
+ * that ended since the previous call into table.last_frame, and adds them to
+ * table.accumulated.
+ */
+static void linux_collate_debug_frame(DebugTable &table) {
+  DebugFrameStats &frame = table.last_frame;
+  frame.frame_count = 1;
+  frame.block_count = 0;
+
+  for (DebugThread &thread : table.threads) {
+    if (!thread.thread_id.load(std::memory_order_relaxed)) {
+      break;
+    }
+
+    const uint64_t write_index =
+        thread.write_index.load(std::memory_order_acquire);
+    for (uint64_t index = thread.read_index; index < write_index; ++index) {
+      DebugEvent event;
+      if (!linux_read_debug_event(thread, index, event)) {
+        // NOTE: The ends of blocks that were open before the lost events
+        // can't be matched anymore
+        thread.open_block_count = 0;
+        continue;
+      }
+
+      if (event.type == DebugEventType::BeginBlock) {
+        // NOTE: Made here rather than at the end, so blocks come before the
+        // ones nested in them
+        linux_get_debug_block_stats(frame, event.name,
+                                    thread.open_block_count);
+        if (thread.open_block_count < thread.open_blocks.size()) {
+          thread.open_blocks[thread.open_block_count] =
+              DebugOpenBlock{event.name, event.clock, 0};
+        }
+        ++thread.open_block_count;
+      } else if (thread.open_block_count) {
+        const uint32_t depth = --thread.open_block_count;
+        if (depth < thread.open_blocks.size()) {
+          const DebugOpenBlock &block = thread.open_blocks[depth];
+          const uint64_t cycle_count = event.clock - block.begin_clock;
+          DebugBlockStats &stats =
+              linux_get_debug_block_stats(frame, block.name, depth);
+          ++stats.hit_count;
+          stats.cycle_count += cycle_count;
+          stats.self_cycle_count += cycle_count - block.child_cycle_count;
+          stats.item_count += event.item_count;
+          if (depth > 0) {
+            thread.open_blocks[depth - 1].child_cycle_count += cycle_count;
+          }
+        }
+      }
+    }
+    thread.read_index = write_index;
+  }
+
+  DebugFrameStats &accumulated = table.accumulated;
+  ++accumulated.frame_count;
+  for (uint32_t i = 0; i < frame.block_count; ++i) {
+    const DebugBlockStats &block = frame.blocks[i];
+    DebugBlockStats &stats =
+        linux_get_debug_block_stats(accumulated, block.name, block.depth);
+    stats.hit_count += block.hit_count;
+    stats.cycle_count += block.cycle_count;
+    stats.self_cycle_count += block.self_cycle_count;
+    stats.item_count += block.item_count;
+  }
+}
+
+/*
+ * NOTE: Prints what every block took per frame on average since the last
+ * call, nested blocks indented under the ones they ran in, then starts over
+ */
+static void linux_print_debug_stats(DebugTable &table) {
+  DebugFrameStats &accumulated = table.accumulated;
+  if (!accumulated.frame_count) {
+    return;
+  }
+
+  const double frame_count = (double)accumulated.frame_count;
+  fprintf(stdout, "profile: %lu frames, per frame:\n",
+          accumulated.frame_count);
+  for (uint32_t i = 0; i < accumulated.block_count; ++i) {
+    const DebugBlockStats &stats = accumulated.blocks[i];
+    if (!stats.hit_count) {
+      continue;
+    }
+    fprintf(stdout, "  %*s%s: %.2f hits, %.0f cycles (%.0f self)",
+            (int)(2 * std::min(stats.depth, 8u)), "", stats.name,
+            (double)stats.hit_count / frame_count,
+            (double)stats.cycle_count / frame_count,
+            (double)stats.self_cycle_count / frame_count);
+    if (stats.item_count) {
+      fprintf(stdout, ", %.2f cycles/item",
+              (double)stats.cycle_count / (double)stats.item_count);
+    }
+    fprintf(stdout, "\n");
+  }
+
+  accumulated.frame_count = 0;
+  accumulated.block_count = 0;
+}
+
+/*
+ * NOTE: Writes every event still in the rings as a Chrome trace (load it in
+ * chrome://tracing or ui.perfetto.dev), one track per thread. The rings keep
+ * the last DEBUG_EVENT_RING_CAPACITY events of each thread, so busy threads
+ * cover less time than idle ones. Block names are used as they are, they
+ * come from identifiers and literals that don't need escaping.
+ */
+static bool linux_write_chrome_trace(const DebugTable &table,
+                                     const char *filename) {
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    linux_log_file_error(filename, "fopen");
+    return false;
+  }
+
+  const double elapsed_microseconds =
+      (double)(linux_get_wall_clock_nanoseconds() - table.base_nanoseconds) /
+      1000.0;
+  const double cycles_per_microsecond =
+      elapsed_microseconds > 0.0
+          ? (double)(__rdtsc() - table.base_clock) / elapsed_microseconds
+          : 1.0;
+
+  fprintf(file, "{\"traceEvents\":[");
+  bool is_first_event = true;
+  for (uint32_t thread_index = 0; thread_index < table.threads.size();
+       ++thread_index) {
+    const DebugThread &thread = table.threads[thread_index];
+    if (!thread.thread_id.load(std::memory_order_relaxed)) {
+      break;
+    }
+
+    const uint64_t write_index =
+        thread.write_index.load(std::memory_order_acquire);
+    uint64_t index = write_index > DEBUG_EVENT_RING_CAPACITY
+                         ? write_index - DEBUG_EVENT_RING_CAPACITY
+                         : 0;
+    // NOTE: Ends whose begin was already overwritten are skipped
+    uint32_t open_block_count = 0;
+    for (; index < write_index; ++index) {
+      DebugEvent event;
+      if (!linux_read_debug_event(thread, index, event)) {
+        continue;
+      }
+      const bool is_begin = event.type == DebugEventType::BeginBlock;
+      if (is_begin) {
+        ++open_block_count;
+      } else if (open_block_count) {
+        --open_block_count;
+      } else {
+        continue;
+      }
+
+      const double timestamp =
+          (double)(int64_t)(event.clock - table.base_clock) /
+          cycles_per_microsecond;
+      fprintf(file,
+              "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,"
+              "\"pid\":0,\"tid\":%u",
+              is_first_event ? "" : ",", event.name, is_begin ? "B" : "E",
+              timestamp, thread_index);
+      if (!is_begin && event.item_count) {
+        fprintf(file, ",\"args\":{\"items\":%u}", event.item_count);
+      }
+      fprintf(file, "}");
+      is_first_event = false;
+    }
+  }
+  fprintf(file, "\n]}\n");
+
+  const bool result = fclose(file) == 0;
+  if (!result) {
+    linux_log_file_error(filename, "fclose");
+  }
+  return result;
+}
+
+static bool DEBUG_platform_write_entire_file(const char *filename,
+                                             const uint64_t size,
+                                             const void *content) {
+  bool result = false;
+
+  const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd >= 0) {
+    const uint8_t *at = (const uint8_t *)content;
+    uint64_t bytes_remaining = size;
+    while (bytes_remaining > 0) {
+      const ssize_t bytes_written = write(fd, at, bytes_remaining);
+      if (bytes_written > 0) {
+        at += bytes_written;
+        bytes_remaining -= (uint64_t)bytes_written;
+      } else if (bytes_written < 0 && errno == EINTR) {
+        continue;
+      } else {
+        linux_log_file_error(filename, "write");
+        break;
+      }
+    }
+    result = bytes_remaining == 0;
+    close(fd);
+  } else {
+    linux_log_file_error(filename, "open");
+  }
+
+  return result;
+}
+#endif
+
+/*
+ * NOTE: The mapping is MAP_PRIVATE and read-only, so it shares the page cache
+ * with every other reader of the file and costs no memory of its own. The fd
+ * isn't needed once the file is mapped.
+ */
+static PlatformFileHandle linux_open_file(const char *filename,
+                                          const PlatformFileUsage usage) {
+  PlatformFileHandle result = {};
+
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    linux_log_file_error(filename, "open");
+    return result;
+  }
+
+  struct stat file_status;
+  if (fstat(fd, &file_status) == 0) {
+    result.size = (uint64_t)file_status.st_size;
+    result.no_errors = true;
+    if (result.size > 0) {
+      void *content = mmap(NULL, result.size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (content != MAP_FAILED) {
+        result.content = content;
+
+        int advice = MADV_WILLNEED;
+        switch (usage) {
+        case PlatformFileUsage::WholeFile: {
+          advice = MADV_WILLNEED;
+        } break;
+        case PlatformFileUsage::Streamed: {
+          advice = MADV_SEQUENTIAL;
+        } break;
+        }
+        // NOTE: Only a hint, failing is harmless
+        madvise(content, result.size, advice);
+      } else {
+        linux_log_file_error(filename, "mmap");
+        result.no_errors = false;
+        result.size = 0;
+      }
+    }
+  } else {
+    linux_log_file_error(filename, "fstat");
+  }
+  close(fd);
+
+  return result;
+}
+
+// NOTE: Copies out of the mapping, a range past the end of the file is an
+// error
+static void linux_read_data_from_file(PlatformFileHandle *handle,
+                                      const uint64_t offset,
+                                      const uint64_t size, void *dest) {
+  if (handle->no_errors &&
+      (offset > handle->size || size > handle->size - offset)) {
+    fprintf(stderr, "read of %lu bytes at %lu is past the end of the file\n",
+            size, offset);
+    handle->no_errors = false;
+  }
+
+  if (!handle->no_errors) {
+    memset(dest, 0, size);
+  } else if (size > 0) {
+    memcpy(dest, (const uint8_t *)handle->content + offset, size);
+  }
+}
+
+static void linux_close_file(PlatformFileHandle *handle) {
+  if (handle->content) {
+    munmap((void *)handle->content, handle->size);
+  }
+  handle->content = NULL;
+  handle->size = 0;
+}
+
+/*
+ * NOTE: An entry's sequence is its index while it's free for the writer that
+ * claims that index, and index + 1 once it holds work for the reader that
+ * claims it. Taking it out makes it index + the ring's size, free for the
+ * writer one lap later. Claiming an index is a compare_exchange on the
+ * shared counter, so any number of threads can write and read.
+ */
+static void linux_add_entry(PlatformWorkQueue *queue,
+                            PlatformWorkQueueCallback *callback, void *data) {
+  const uint32_t entry_count = (uint32_t)queue->entries.size();
+  uint32_t entry_index =
+      queue->next_entry_to_write.load(std::memory_order_relaxed);
+  for (;;) {
+    const PlatformWorkQueueEntry &entry =
+        queue->entries[entry_index % entry_count];
+    const uint32_t sequence = entry.sequence.load(std::memory_order_acquire);
+    const int32_t lap = (int32_t)(sequence - entry_index);
+    // NOTE: The queue is full, complete_all_work should have been called
+    ASSERT(lap >= 0);
+    if (lap == 0) {
+      if (queue->next_entry_to_write.compare_exchange_weak(
+              entry_index, entry_index + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else {
+      entry_index = queue->next_entry_to_write.load(std::memory_order_relaxed);
+    }
+  }
+
+  PlatformWorkQueueEntry &entry = queue->entries[entry_index % entry_count];
+  entry.callback = callback;
+  entry.data = data;
+  queue->completion_goal.fetch_add(1, std::memory_order_relaxed);
+  entry.sequence.store(entry_index + 1, std::memory_order_release);
+  sem_post(queue->semaphore);
+}
+
+static bool linux_do_next_work_queue_entry(PlatformWorkQueue *queue) {
+  bool should_sleep = false;
+
+  const uint32_t entry_count = (uint32_t)queue->entries.size();
+  uint32_t entry_index =
+      queue->next_entry_to_read.load(std::memory_order_relaxed);
+  for (;;) {
+    PlatformWorkQueueEntry &entry = queue->entries[entry_index % entry_count];
+    const uint32_t sequence = entry.sequence.load(std::memory_order_acquire);
+    const int32_t lap = (int32_t)(sequence - (entry_index + 1));
+    if (lap < 0) {
+      should_sleep = true;
+      break;
+    } else if (lap == 0) {
+      if (queue->next_entry_to_read.compare_exchange_weak(
+              entry_index, entry_index + 1, std::memory_order_relaxed)) {
+        PlatformWorkQueueCallback *callback = entry.callback;
+        void *data = entry.data;
+        entry.sequence.store(entry_index + entry_count,
+                             std::memory_order_release);
+        callback(queue, data);
+        queue->completion_count.fetch_add(1, std::memory_order_release);
+        break;
+      }
+    } else {
+      entry_index = queue->next_entry_to_read.load(std::memory_order_relaxed);
+    }
+  }
+
+  return should_sleep;
+}
+
+/*
+ * NOTE: Also waits for entries other threads add meanwhile. The counts are
+ * never reset, another thread may be adding while this one returns.
+ *
+ * The count is read before the goal: an entry that adds another bumps the
+ * goal before its own completion bumps the count, so a count that includes
+ * the parent comes with a goal that includes the child.
+ */
+static void linux_complete_all_work(PlatformWorkQueue *queue) {
+  for (;;) {
+    const uint32_t completion_count =
+        queue->completion_count.load(std::memory_order_acquire);
+    if (completion_count ==
+        queue->completion_goal.load(std::memory_order_relaxed)) {
+      break;
+    }
+    linux_do_next_work_queue_entry(queue);
+  }
+}
+
+static void linux_work_on_queues(LinuxWorkQueues *queues,
+                                 const bool takes_high_priority) {
+  for (;;) {
+    const bool should_sleep =
+        (!takes_high_priority ||
+         linux_do_next_work_queue_entry(&queues->high_priority)) &&
+        linux_do_next_work_queue_entry(&queues->low_priority);
+    if (should_sleep) {
+      sem_wait(&queues->semaphore);
+    }
+  }
+}
+
+static void *linux_worker_thread_proc(void *parameter) {
+  linux_work_on_queues((LinuxWorkQueues *)parameter, true);
+  return NULL;
+}
+
+static void *linux_low_priority_worker_thread_proc(void *parameter) {
+  linux_work_on_queues((LinuxWorkQueues *)parameter, false);
+  return NULL;
+}
+
+static uint32_t linux_get_default_worker_thread_count() {
+  // NOTE: The main thread also works on the queue while it waits
+  const long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+  return processor_count > 1 ? (uint32_t)(processor_count - 1) : 0;
+}
+
+static void linux_init_queue(PlatformWorkQueue *queue, sem_t *semaphore) {
+  queue->completion_goal = 0;
+  queue->completion_count = 0;
+  queue->next_entry_to_write = 0;
+  queue->next_entry_to_read = 0;
+  queue->semaphore = semaphore;
+  for (uint32_t entry_index = 0; entry_index < queue->entries.size();
+       ++entry_index) {
+    queue->entries[entry_index].sequence = entry_index;
+  }
+}
+
+/*
+ * NOTE: Starts thread_count workers. The main thread only runs entries of a
+ * queue it completes, so with no workers one is still started for low
+ * priority work, which nobody waits on.
+ */
+static void linux_make_work_queues(LinuxWorkQueues *queues,
+                                   const uint32_t thread_count) {
+  sem_init(&queues->semaphore, 0, 0);
+  linux_init_queue(&queues->high_priority, &queues->semaphore);
+  linux_init_queue(&queues->low_priority, &queues->semaphore);
+
+  void *(*thread_proc)(void *) = thread_count > 0
+                                     ? linux_worker_thread_proc
+                                     : linux_low_priority_worker_thread_proc;
+  for (uint32_t thread_index = 0; thread_index < std::max(thread_count, 1u);
+       ++thread_index) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, thread_proc, queues) == 0) {
+      pthread_detach(thread);
+    } else {
+      // TODO: Log
+    }
+  }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "handmade.h"
+
+#include <atomic>
+#include <cstdint>
+#include <semaphore.h>
+
+struct PlatformWorkQueueEntry {
+  // NOTE: Which lap around the ring the entry is on, see linux_add_entry
+  std::atomic<uint32_t> sequence;
+  PlatformWorkQueueCallback *callback;
+  void *data;
+};
+
+/*
+ * NOTE: Bounded multiple producer, multiple consumer ring. Entries can be
+ * added from any thread, including from inside other entries. The indices
+ * only ever grow and wrap around with uint32_t, which the ring's size
+ * divides.
+ */
+struct PlatformWorkQueue {
+  std::atomic<uint32_t> completion_goal;
+  std::atomic<uint32_t> completion_count;
+
+  std::atomic<uint32_t> next_entry_to_write;
+  std::atomic<uint32_t> next_entry_to_read;
+  // NOTE: Shared by every queue the workers serve, posted once per entry
+  sem_t *semaphore;
+
+  std::array<PlatformWorkQueueEntry, 1024> entries;
+};
+
+/*
+ * NOTE: The queues handed to the game, served by one pool of workers. Idle
+ * workers sleep on the semaphore, and take high priority entries before low
+ * priority ones, so a long load never holds up the frame's tiles for more
+ * than one entry per worker.
+ */
+struct LinuxWorkQueues {
+  PlatformWorkQueue high_priority;
+  PlatformWorkQueue low_priority;
+  sem_t semaphore;
+};
+
+/*
+ * NOTE: How GameMemory gets backed. Huge pages cut TLB misses on the big
+ * blocks, prefaulting moves the first-touch page faults of permanent storage
+ * out of the first frames.
+ */
+struct LinuxMemoryOptions {
+  // NOTE: MAP_HUGETLB needs pages reserved in /proc/sys/vm/nr_hugepages, if
+  // there aren't enough we fall back to regular pages
+  bool use_hugetlb;
+  // NOTE: madvise(MADV_HUGEPAGE), needs THP set to "madvise" or "always".
+  // Lost once looped playback moves GameMemory onto a memfd (LinuxState).
+  bool use_transparent_huge_pages;
+  bool prefault_permanent_storage;
+};
+
+// NOTE: Each rect is a separate request to the X server, past this many it's
+// cheaper to present their bounding rect
+constexpr uint32_t LINUX_MAX_PRESENT_RECT_COUNT = 16;
+
+constexpr uint64_t LINUX_UPDATE_NANOSECONDS = 1000000000ull / GAME_UPDATE_HZ;
+// NOTE: Past this many updates in a frame the simulation falls behind real
+// time instead, or a frame too slow to keep up would only make the next one
+// slower
+constexpr uint32_t LINUX_MAX_UPDATES_PER_FRAME = 8;
+
+// NOTE: How far real time has run ahead of the simulation
+struct LinuxUpdateClock {
+  uint64_t lag_nanoseconds;
+  uint64_t dropped_update_count;
+};
+
+struct LinuxPageFaultCounts {
+  uint64_t minor;
+  uint64_t major;
+};
+
+/*
+ * NOTE: GameMemory starts out as anonymous memory. The first snapshot (input
+ * recording, HANDMADE_INTERNAL builds only) copies it into a memfd and maps
+ * that over the block with MAP_PRIVATE. From then on the memfd holds the
+ * snapshot taken when input recording starts, so restoring it is just
+ * dropping the private pages the game has dirtied since (MADV_DONTNEED),
+ * which costs time proportional to what was touched rather than to the size
+ * of the block.
+ */
+struct LinuxState {
+  void *game_memory_block;
+  uint64_t total_size;
+  // NOTE: -1 until the first snapshot
+  int snapshot_fd;
+  // NOTE: False for hugetlb memory and in builds without looped playback
+  bool can_snapshot_game_memory;
+  // NOTE: Emptied before game memory is snapshotted or restored, queued work
+  // writes into it. May be NULL.
+  LinuxWorkQueues *work_queues;
+
+  int recording_fd;
+  bool is_recording;
+  bool is_playing_back;
+};
@@ -1,52 +1,113 @@
 #include "linux_handmade.h"
 #include "handmade.h"
 
-#include "handmade.cpp"
+#include "linux_common.cpp"
+#include "linux_input.cpp"
 
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xrandr.h>
 #include <algorithm>
 #include <alsa/asoundlib.h>
+#include <climits>
 #include <cstdint>
 #include <cstdio>
 #include <ctime>
 #include <dirent.h>
+#include <dlfcn.h>
 #include <fcntl.h>
 #include <libevdev/libevdev.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ipc.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/shm.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <x86intrin.h>
 
-static constexpr uint32_t CHANNELS = 2;
-
 static bool running;
 static LinuxX11OffscreenBuffer global_backbuffer;
-static snd_pcm_t *pcm_handle;
+static bool global_shm_available;
+static int global_shm_completion_event;
+static bool global_shm_attach_failed;
+// NOTE: The size the window was last configured to. Applied once per frame,
+// however many ConfigureNotify events arrived in between.
+static LinuxWindowDimension global_pending_window_dimension;
+// NOTE: Set by Expose, the next present covers the whole window
+static bool global_present_everything;
+#if HANDMADE_INTERNAL
+// NOTE: Set by a key press, the profiler's trace is written at the end of the
+// frame
+static bool global_write_debug_trace;
+#endif
 
-static void linux_alsa_init(uint32_t samples_per_second,
-                            uint32_t samples_per_write) {
+/*
+ * NOTE: With `use_mmap` set the device is opened with mmap access and a
+ * buffer of `buffer_sample_count` frames, which the main thread fills directly
+ * once per frame. If the device can't do mmap access `use_mmap` is cleared and
+ * it's opened for the audio thread instead: read/write access and two periods.
+ */
+static snd_pcm_t *linux_alsa_init(const uint32_t samples_per_second,
+                                  const uint32_t period_sample_count,
+                                  const uint32_t buffer_sample_count,
+                                  bool &use_mmap) {
   const char *PCM_DEVICE = "default";
 
+  snd_pcm_t *pcm_handle = NULL;
   snd_pcm_hw_params_t *hw_params;
+  snd_pcm_sw_params_t *sw_params;
 
   if (snd_pcm_open(&pcm_handle, PCM_DEVICE, SND_PCM_STREAM_PLAYBACK,
                    SND_PCM_NONBLOCK) >= 0) {
     snd_pcm_hw_params_alloca(&hw_params);
     snd_pcm_hw_params_any(pcm_handle, hw_params);
 
-    snd_pcm_hw_params_set_access(pcm_handle, hw_params,
-                                 SND_PCM_ACCESS_RW_INTERLEAVED);
+    if (use_mmap && snd_pcm_hw_params_set_access(
+                        pcm_handle, hw_params,
+                        SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0) {
+      // TODO: Log that we fell back to the audio thread
+      use_mmap = false;
+    }
+    if (!use_mmap) {
+      snd_pcm_hw_params_set_access(pcm_handle, hw_params,
+                                   SND_PCM_ACCESS_RW_INTERLEAVED);
+    }
     snd_pcm_hw_params_set_format(pcm_handle, hw_params, SND_PCM_FORMAT_S16_LE);
     snd_pcm_hw_params_set_channels(pcm_handle, hw_params, CHANNELS);
     snd_pcm_hw_params_set_rate(pcm_handle, hw_params, samples_per_second, 0);
-    snd_pcm_hw_params_set_buffer_size(pcm_handle, hw_params, samples_per_write);
-    snd_pcm_hw_params_set_period_time(pcm_handle, hw_params,
-                                      samples_per_write / 2, 0);
+    snd_pcm_uframes_t period_size = period_sample_count;
+    snd_pcm_hw_params_set_period_size_near(pcm_handle, hw_params, &period_size,
+                                           NULL);
+    // NOTE: Two periods, the audio thread refills one while the other plays.
+    // In mmap mode the device buffer is the only queue, so it has to hold a
+    // whole frame's worth of samples.
+    snd_pcm_uframes_t buffer_size =
+        use_mmap ? buffer_sample_count : 2 * period_size;
+    snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hw_params,
+                                           &buffer_size);
 
     if (snd_pcm_hw_params(pcm_handle, hw_params) >= 0) {
+      snd_pcm_sw_params_alloca(&sw_params);
+      snd_pcm_sw_params_current(pcm_handle, sw_params);
+      snd_pcm_sw_params_set_avail_min(pcm_handle, sw_params, period_size);
+      snd_pcm_sw_params_set_start_threshold(pcm_handle, sw_params,
+                                            period_size);
+      if (snd_pcm_sw_params(pcm_handle, sw_params) < 0) {
+        // TODO: Log
+      }
+    } else {
+      // TODO: Log
+      snd_pcm_close(pcm_handle);
+      pcm_handle = NULL;
     }
   }
+
+  return pcm_handle;
 }
 
 static LinuxWindowDimension
@@ -61,25 +122,202 @@ linux_x11_get_window_dimension(Display *const display, const Window window) {
   }
 }
 
-static void linux_x11_resize_bitmap(LinuxX11OffscreenBuffer &buffer,
+/*
+ * NOTE: Refresh rate of the CRTC the window's center is on, or of the first
+ * active one if it's on none of them. 0 if XRandR can't tell.
+ */
+static float linux_x11_get_refresh_rate(Display *const display,
+                                        const Window window) {
+  int event_base, error_base;
+  if (!XRRQueryExtension(display, &event_base, &error_base)) {
+    return 0.0f;
+  }
+  XRRScreenResources *const resources =
+      XRRGetScreenResourcesCurrent(display, window);
+  if (!resources) {
+    return 0.0f;
+  }
+
+  const LinuxWindowDimension dimension =
+      linux_x11_get_window_dimension(display, window);
+  int center_x = 0;
+  int center_y = 0;
+  Window child;
+  XTranslateCoordinates(display, window, DefaultRootWindow(display),
+                        (int)dimension.width / 2, (int)dimension.height / 2,
+                        &center_x, &center_y, &child);
+
+  float result = 0.0f;
+  bool found_window = false;
+  for (int crtc_index = 0; crtc_index < resources->ncrtc && !found_window;
+       ++crtc_index) {
+    XRRCrtcInfo *const crtc =
+        XRRGetCrtcInfo(display, resources, resources->crtcs[crtc_index]);
+    if (!crtc) {
+      continue;
+    }
+    for (int mode_index = 0; mode_index < resources->nmode; ++mode_index) {
+      const XRRModeInfo &mode = resources->modes[mode_index];
+      if (crtc->mode != None && mode.id == crtc->mode && mode.hTotal &&
+          mode.vTotal) {
+        double line_count = mode.vTotal;
+        if (mode.modeFlags & RR_DoubleScan) {
+          line_count *= 2.0;
+        }
+        if (mode.modeFlags & RR_Interlace) {
+          line_count /= 2.0;
+        }
+        found_window = center_x >= crtc->x &&
+                       center_x < crtc->x + (int)crtc->width &&
+                       center_y >= crtc->y &&
+                       center_y < crtc->y + (int)crtc->height;
+        if (result == 0.0f || found_window) {
+          result = (float)((double)mode.dotClock /
+                           ((double)mode.hTotal * line_count));
+        }
+        break;
+      }
+    }
+    XRRFreeCrtcInfo(crtc);
+  }
+
+  XRRFreeScreenResources(resources);
+  return result;
+}
+
+static int linux_x11_shm_attach_error_handler(Display *, XErrorEvent *) {
+  global_shm_attach_failed = true;
+  return 0;
+}
+
+static void linux_x11_init_shm(Display *const display) {
+  // NOTE: The extension can be present but unusable (e.g. remote displays),
+  // which is only detected when attaching, see linux_x11_create_shm_image
+  global_shm_available = XShmQueryExtension(display) == True;
+  if (global_shm_available) {
+    global_shm_completion_event = XShmGetEventBase(display) + ShmCompletion;
+  } else {
+    // TODO: Log that we are falling back to XPutImage
+  }
+}
+
+static Bool linux_x11_is_shm_completion_event(Display *, XEvent *event,
+                                              XPointer) {
+  return event->type == global_shm_completion_event ? True : False;
+}
+
+static void linux_x11_wait_for_shm_put(Display *const display,
+                                       LinuxX11OffscreenBuffer &buffer) {
+  if (buffer.shm_put_pending) {
+    XEvent event;
+    XIfEvent(display, &event, linux_x11_is_shm_completion_event, NULL);
+    buffer.shm_put_pending = false;
+  }
+}
+
+static void linux_x11_destroy_shm_image(Display *const display,
+                                        LinuxX11OffscreenBuffer &buffer) {
+  linux_x11_wait_for_shm_put(display, buffer);
+  XShmDetach(display, &buffer.shm_info);
+  // NOTE: XDestroyImage would free() the shared segment otherwise
+  buffer.shm_image->data = NULL;
+  XDestroyImage(buffer.shm_image);
+  shmdt(buffer.shm_info.shmaddr);
+  buffer.shm_image = NULL;
+  buffer.shm_info = {};
+}
+
+static bool linux_x11_create_shm_image(Display *const display,
+                                       LinuxX11OffscreenBuffer &buffer,
+                                       const uint32_t width,
+                                       const uint32_t height) {
+  const int screen = DefaultScreen(display);
+  buffer.shm_image =
+      XShmCreateImage(display, DefaultVisual(display, screen), 24, ZPixmap,
+                      NULL, &buffer.shm_info, width, height);
+  if (!buffer.shm_image) {
+    return false;
+  }
+
+  buffer.shm_info.shmid =
+      shmget(IPC_PRIVATE,
+             (size_t)(buffer.shm_image->bytes_per_line *
+                      buffer.shm_image->height),
+             IPC_CREAT | 0600);
+  if (buffer.shm_info.shmid < 0) {
+    XDestroyImage(buffer.shm_image);
+    buffer.shm_image = NULL;
+    return false;
+  }
+
+  buffer.shm_info.shmaddr = (char *)shmat(buffer.shm_info.shmid, NULL, 0);
+  buffer.shm_info.readOnly = False;
+
+  bool attached = false;
+  if (buffer.shm_info.shmaddr != (char *)-1) {
+    buffer.shm_image->data = buffer.shm_info.shmaddr;
+
+    global_shm_attach_failed = false;
+    XErrorHandler old_handler =
+        XSetErrorHandler(linux_x11_shm_attach_error_handler);
+    XShmAttach(display, &buffer.shm_info);
+    XSync(display, False);
+    XSetErrorHandler(old_handler);
+    attached = !global_shm_attach_failed;
+  }
+
+  // NOTE: Once both sides are attached the segment can be marked for removal,
+  // so it doesn't leak if we crash
+  shmctl(buffer.shm_info.shmid, IPC_RMID, NULL);
+
+  if (!attached) {
+    if (buffer.shm_info.shmaddr != (char *)-1) {
+      shmdt(buffer.shm_info.shmaddr);
+    }
+    buffer.shm_image->data = NULL;
+    XDestroyImage(buffer.shm_image);
+    buffer.shm_image = NULL;
+    buffer.shm_info = {};
+    global_shm_available = false;
+    // TODO: Log that we are falling back to XPutImage
+    return false;
+  }
+
+  return true;
+}
+
+static void linux_x11_resize_bitmap(Display *const display,
+                                    LinuxX11OffscreenBuffer &buffer,
                                     const uint32_t width,
                                     const uint32_t height) {
   // TODO: maybe only destroy after successfully creating another one, and if
   // failed, destroy first
-  if (buffer.memory) {
+  if (buffer.shm_image) {
+    linux_x11_destroy_shm_image(display, buffer);
+  } else if (buffer.memory) {
     munmap(buffer.memory, buffer.memory_size);
   }
+  buffer.memory = NULL;
+  buffer.contents_lost = true;
 
   buffer.width = width;
   buffer.height = height;
   buffer.bytes_per_pixel = 4;
 
   buffer.memory_size = width * height * buffer.bytes_per_pixel;
+  buffer.pitch = width * buffer.bytes_per_pixel;
+
+  if (global_shm_available &&
+      linux_x11_create_shm_image(display, buffer, width, height)) {
+    buffer.memory = buffer.shm_image->data;
+    buffer.pitch = (uint32_t)buffer.shm_image->bytes_per_line;
+    buffer.memory_size = buffer.pitch * height;
+    return;
+  }
+
   buffer.memory = mmap(NULL, buffer.memory_size, PROT_READ | PROT_WRITE,
                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-  buffer.pitch = width * buffer.bytes_per_pixel;
-
   buffer.image.width = (int)width;
   buffer.image.height = (int)height;
   buffer.image.xoffset = 0;
@@ -101,149 +339,648 @@ static void linux_x11_resize_bitmap(LinuxX11OffscreenBuffer &buffer,
   }
 }
 
-static void linux_x11_display_buffer_in_window(Display *const display,
-                                               const Window window, const GC gc,
-                                               LinuxX11OffscreenBuffer buffer,
-                                               const uint32_t window_width,
-                                               const uint32_t window_height) {
-  XPutImage(display, window, gc, &buffer.image, 0, 0, 0, 0, window_width,
-            window_height);
+/*
+ * NOTE: Presents only `rects` of the buffer, the rest of the window keeps
+ * what was presented before
+ */
+static void linux_x11_display_buffer_in_window(
+    Display *const display, const Window window, const GC gc,
+    LinuxX11OffscreenBuffer &buffer, const uint32_t window_width,
+    const uint32_t window_height, const GameDirtyRect *rects,
+    const uint32_t rect_count) {
+  const uint32_t max_x = std::min(buffer.width, window_width);
+  const uint32_t max_y = std::min(buffer.height, window_height);
+  if (buffer.shm_image) {
+    // NOTE: The server reads straight from the segment, so the game must not
+    // touch it until the completion event arrives
+    linux_x11_wait_for_shm_put(display, buffer);
+  }
+
+  // NOTE: Puts are handled in order, so only the last one needs to send a
+  // completion event
+  int last_rect_index = -1;
+  for (uint32_t i = 0; i < rect_count; ++i) {
+    if (rects[i].min_x < max_x && rects[i].min_y < max_y) {
+      last_rect_index = (int)i;
+    }
+  }
+  for (int i = 0; i <= last_rect_index; ++i) {
+    const GameDirtyRect &rect = rects[i];
+    if (rect.min_x >= max_x || rect.min_y >= max_y) {
+      continue;
+    }
+
+    const int x = (int)rect.min_x;
+    const int y = (int)rect.min_y;
+    const uint32_t width = std::min(rect.max_x, max_x) - rect.min_x;
+    const uint32_t height = std::min(rect.max_y, max_y) - rect.min_y;
+    if (buffer.shm_image) {
+      XShmPutImage(display, window, gc, buffer.shm_image, x, y, x, y, width,
+                   height, i == last_rect_index ? True : False);
+    } else {
+      XPutImage(display, window, gc, &buffer.image, x, y, x, y, width,
+                height);
+    }
+  }
+  if (buffer.shm_image && last_rect_index >= 0) {
+    buffer.shm_put_pending = true;
+  }
 }
 
-static void linux_process_keyboard_message(GameButtonState *new_state,
-                                           bool is_down) {
-  ASSERT(new_state->ended_down != is_down);
-  new_state->ended_down = is_down;
-  ++new_state->half_transition_count;
+/*
+ * NOTE: Scaled present. With a fixed resolution the game renders into its own
+ * buffer, which is stretched over the window-sized backbuffer before it's
+ * presented. Source positions are 16.16 fixed point, sampled at the centre
+ * of each destination pixel.
+ */
+
+// NOTE: Which window pixels show any of `rect`, grown by a pixel on every
+// side since bilinear filtering reaches into the neighbouring pixels
+static GameDirtyRect linux_scale_dirty_rect(const GameDirtyRect &rect,
+                                            const GameOffscreenBuffer &source,
+                                            const GameOffscreenBuffer &dest) {
+  const uint64_t min_x = (uint64_t)rect.min_x * dest.width / source.width;
+  const uint64_t min_y = (uint64_t)rect.min_y * dest.height / source.height;
+  const uint64_t max_x =
+      ((uint64_t)rect.max_x * dest.width + source.width - 1) / source.width;
+  const uint64_t max_y =
+      ((uint64_t)rect.max_y * dest.height + source.height - 1) /
+      source.height;
+  return GameDirtyRect{min_x ? (uint32_t)min_x - 1 : 0,
+                       min_y ? (uint32_t)min_y - 1 : 0,
+                       std::min((uint32_t)max_x + 1, dest.width),
+                       std::min((uint32_t)max_y + 1, dest.height)};
 }
 
-static void linux_process_evdev_digital_button(input_event input_event,
-                                               GameButtonState *old_state,
-                                               int button_code,
-                                               GameButtonState *new_state) {
-  new_state->ended_down =
-      input_event.code == button_code && input_event.value == 1;
-  new_state->half_transition_count =
-      (old_state->ended_down != new_state->ended_down) ? 1 : 0;
+static inline int64_t linux_scale_step(const uint32_t source_size,
+                                       const uint32_t dest_size) {
+  return (((int64_t)source_size << 16) + dest_size / 2) / dest_size;
 }
 
-static float linux_process_evdev_stick_value(int32_t value,
-                                             const int32_t deadzone) {
-  float result = 0.0f;
-  if (value < 128 - deadzone || value > 128 + deadzone) {
-    result = (float)(value - 128);
-    if (result < 0) {
-      result /= 128.0f;
-    } else {
-      result /= 127.0f;
+static inline int64_t linux_scale_position(const uint32_t dest_position,
+                                           const int64_t step) {
+  return (int64_t)dest_position * step + step / 2;
+}
+
+// NOTE: The step is rounded to nearest, so positions near the far edge can
+// land one texel past it
+static inline uint32_t linux_scale_nearest_index(const int64_t position,
+                                                 const uint32_t source_size) {
+  return std::min((uint32_t)(position >> 16), source_size - 1);
+}
+
+/*
+ * NOTE: 4 pixels per store, their sources are still read one at a time
+ */
+static void linux_scale_nearest(const GameOffscreenBuffer &source,
+                                const GameOffscreenBuffer &dest,
+                                const GameDirtyRect &rect) {
+  const int64_t step_x = linux_scale_step(source.width, dest.width);
+  const int64_t step_y = linux_scale_step(source.height, dest.height);
+  const uint32_t wide_max_x = rect.min_x + ((rect.max_x - rect.min_x) & ~3u);
+
+  for (uint32_t y = rect.min_y; y < rect.max_y; ++y) {
+    const uint32_t source_y = linux_scale_nearest_index(
+        linux_scale_position(y, step_y), source.height);
+    const uint32_t *source_row =
+        (const uint32_t *)((const uint8_t *)source.memory +
+                           source_y * source.pitch);
+    uint32_t *pixel = (uint32_t *)((uint8_t *)dest.memory + y * dest.pitch) +
+                      rect.min_x;
+
+    int64_t source_x = linux_scale_position(rect.min_x, step_x);
+    uint32_t x = rect.min_x;
+    for (; x < wide_max_x; x += 4, pixel += 4) {
+      const __m128i color = _mm_setr_epi32(
+          (int)source_row[linux_scale_nearest_index(source_x, source.width)],
+          (int)source_row[linux_scale_nearest_index(source_x + step_x,
+                                                    source.width)],
+          (int)source_row[linux_scale_nearest_index(source_x + 2 * step_x,
+                                                    source.width)],
+          (int)source_row[linux_scale_nearest_index(source_x + 3 * step_x,
+                                                    source.width)]);
+      _mm_storeu_si128((__m128i *)pixel, color);
+      source_x += 4 * step_x;
+    }
+    for (; x < rect.max_x; ++x, ++pixel) {
+      *pixel = source_row[linux_scale_nearest_index(source_x, source.width)];
+      source_x += step_x;
     }
   }
+}
 
-  return result;
+/*
+ * NOTE: The source index and 7 bit weight of the texel to the left of (or
+ * above) a fixed point position. At the far edge the weight is pushed to 128
+ * instead, so both texels read are always inside the source.
+ */
+static inline void linux_scale_bilinear_texel(int64_t position,
+                                              const uint32_t source_size,
+                                              uint32_t &index,
+                                              uint32_t &weight) {
+  position = std::max(position - 32768, (int64_t)0);
+  index = (uint32_t)(position >> 16);
+  weight = (uint32_t)(position >> 9) & 0x7F;
+  if (index >= source_size - 1) {
+    index = source_size - 2;
+    weight = 128;
+  }
 }
 
-static uint32_t linux_alsa_get_samples_to_write(uint32_t sample_count) {
-  snd_pcm_sframes_t delay = 0;
-  snd_pcm_sframes_t available = (snd_pcm_sframes_t)sample_count;
-  uint32_t result;
+// NOTE: a + (b - a) * weight / 128, rounded. Can't overflow 16 bits since
+// |b - a| <= 255.
+static inline __m128i linux_scale_lerp(const __m128i a, const __m128i b,
+                                       const __m128i weight) {
+  return _mm_add_epi16(
+      a, _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(b, a),
+                                                      weight),
+                                      _mm_set1_epi16(64)),
+                        7));
+}
 
-  if (pcm_handle) {
-    snd_pcm_avail_delay(pcm_handle, &available, &delay);
-  }
-  result = sample_count - (uint32_t)delay;
-  return std::min(result, (uint32_t)available);
+/*
+ * NOTE: Channels are widened to 16 bits, each load brings in a pixel and its
+ * right neighbour. Rows are blended first, then the pair is blended.
+ */
+static inline __m128i linux_scale_bilinear_pixel(const uint32_t *row,
+                                                 const uint32_t *next_row,
+                                                 const uint32_t x,
+                                                 const uint32_t weight_x,
+                                                 const __m128i weight_y) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i top =
+      _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x)), zero);
+  const __m128i bottom = _mm_unpacklo_epi8(
+      _mm_loadl_epi64((const __m128i *)(next_row + x)), zero);
+  const __m128i pair = linux_scale_lerp(top, bottom, weight_y);
+  return linux_scale_lerp(pair, _mm_unpackhi_epi64(pair, pair),
+                          _mm_set1_epi16((int16_t)weight_x));
 }
 
-static void linux_alsa_fill_sound_buffer(int16_t *samples,
-                                         uint32_t sample_count) {
-  if (pcm_handle) {
-    snd_pcm_sframes_t result =
-        snd_pcm_writei(pcm_handle, samples, sample_count);
-    if (result == -EAGAIN) {
-      // Just skip this frame
-    } else if (result < 0) {
-      snd_pcm_prepare(pcm_handle);
+static void linux_scale_bilinear(const GameOffscreenBuffer &source,
+                                 const GameOffscreenBuffer &dest,
+                                 const GameDirtyRect &rect) {
+  ASSERT(source.width >= 2 && source.height >= 2);
+  const int64_t step_x = linux_scale_step(source.width, dest.width);
+  const int64_t step_y = linux_scale_step(source.height, dest.height);
+  const uint32_t pair_max_x = rect.min_x + ((rect.max_x - rect.min_x) & ~1u);
+
+  for (uint32_t y = rect.min_y; y < rect.max_y; ++y) {
+    uint32_t source_y, weight_y;
+    linux_scale_bilinear_texel(linux_scale_position(y, step_y), source.height,
+                               source_y, weight_y);
+    const uint32_t *source_row =
+        (const uint32_t *)((const uint8_t *)source.memory +
+                           source_y * source.pitch);
+    const uint32_t *next_source_row =
+        (const uint32_t *)((const uint8_t *)source_row + source.pitch);
+    const __m128i wide_weight_y = _mm_set1_epi16((int16_t)weight_y);
+    uint32_t *pixel = (uint32_t *)((uint8_t *)dest.memory + y * dest.pitch) +
+                      rect.min_x;
+
+    int64_t source_x = linux_scale_position(rect.min_x, step_x);
+    uint32_t x = rect.min_x;
+    for (; x < pair_max_x; x += 2, pixel += 2) {
+      uint32_t first_x, first_weight, second_x, second_weight;
+      linux_scale_bilinear_texel(source_x, source.width, first_x,
+                                 first_weight);
+      linux_scale_bilinear_texel(source_x + step_x, source.width, second_x,
+                                 second_weight);
+      const __m128i first =
+          linux_scale_bilinear_pixel(source_row, next_source_row, first_x,
+                                     first_weight, wide_weight_y);
+      const __m128i second =
+          linux_scale_bilinear_pixel(source_row, next_source_row, second_x,
+                                     second_weight, wide_weight_y);
+      const __m128i both = _mm_unpacklo_epi64(first, second);
+      _mm_storel_epi64((__m128i *)pixel, _mm_packus_epi16(both, both));
+      source_x += 2 * step_x;
+    }
+    if (x < rect.max_x) {
+      uint32_t last_x, last_weight;
+      linux_scale_bilinear_texel(source_x, source.width, last_x, last_weight);
+      const __m128i last = linux_scale_bilinear_pixel(
+          source_row, next_source_row, last_x, last_weight, wide_weight_y);
+      *pixel = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(last, last));
     }
   }
 }
 
-static DEBUGReadFileResult
-DEBUG_platform_read_entire_file(const char *filename) {
-  DEBUGReadFileResult result = {};
-  int fd = open(filename, O_RDONLY);
-  if (fd > 0) {
-    struct stat file_status;
-    if (fstat(fd, &file_status) == 0) {
-      result.content_size = SAFE_TRUNCATE_U64((uint64_t)file_status.st_size);
-      result.content =
-          mmap(NULL, result.content_size * sizeof(uint32_t),
-               PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-      if (result.content) {
-        if (read(fd, result.content, result.content_size) ==
-            (ssize_t)result.content_size) {
-          // File read successfully
-        } else {
-          DEBUG_platform_free_file_memory(result);
-          // TODO: Log
+static uint32_t linux_audio_ring_queued(const LinuxAudioRing &ring) {
+  return (uint32_t)(ring.write_index.load(std::memory_order_acquire) -
+                    ring.read_index.load(std::memory_order_acquire));
+}
+
+/*
+ * NOTE: Has the game write `sample_count` frames at the ring's write index,
+ * in two calls when the region wraps around the end of the ring
+ */
+static void linux_audio_ring_write_game_samples(
+    LinuxAudioRing &ring, GameMemory &game_memory,
+    GameGetSoundSamples *get_sound_samples, const uint32_t samples_per_second,
+    const uint32_t sample_count) {
+  const uint64_t write_index =
+      ring.write_index.load(std::memory_order_relaxed);
+  ASSERT(linux_audio_ring_queued(ring) + sample_count <= ring.capacity);
+
+  const uint32_t offset = (uint32_t)(write_index & (ring.capacity - 1));
+  const uint32_t first_count = std::min(sample_count, ring.capacity - offset);
+  const GameSoundOutputBuffer first_region{
+      samples_per_second, first_count, ring.samples + offset * CHANNELS};
+  get_sound_samples(game_memory, first_region);
+  if (first_count < sample_count) {
+    const GameSoundOutputBuffer second_region{
+        samples_per_second, sample_count - first_count, ring.samples};
+    get_sound_samples(game_memory, second_region);
+  }
+
+  ring.write_index.store(write_index + sample_count,
+                         std::memory_order_release);
+}
+
+static void linux_alsa_recover(snd_pcm_t *pcm_handle, const int error) {
+  if (snd_pcm_recover(pcm_handle, error, 1) < 0) {
+    snd_pcm_prepare(pcm_handle);
+  }
+}
+
+/*
+ * NOTE: Sleeps on the PCM's poll descriptors and moves whatever the ring holds
+ * into the device as soon as it has room for a period. When the ring is empty
+ * it writes a period of silence instead, so the device never underruns.
+ */
+static void *linux_audio_thread_proc(void *parameter) {
+  LinuxAudioThread *audio = (LinuxAudioThread *)parameter;
+  LinuxAudioRing &ring = *audio->ring;
+  snd_pcm_t *pcm_handle = audio->pcm_handle;
+
+  std::array<pollfd, 8> poll_fds;
+  const int poll_fd_count =
+      std::min(snd_pcm_poll_descriptors_count(pcm_handle),
+               (int)poll_fds.size());
+  snd_pcm_poll_descriptors(pcm_handle, poll_fds.data(),
+                           (unsigned int)poll_fd_count);
+
+  std::array<int16_t, 1024 * CHANNELS> silence = {};
+
+  while (audio->running.load(std::memory_order_relaxed)) {
+    // NOTE: The timeout only matters for noticing shutdown
+    if (poll(poll_fds.data(), (nfds_t)poll_fd_count, 100) <= 0) {
+      continue;
+    }
+    unsigned short revents = 0;
+    snd_pcm_poll_descriptors_revents(pcm_handle, poll_fds.data(),
+                                     (unsigned int)poll_fd_count, &revents);
+    if (revents & POLLERR) {
+      linux_alsa_recover(pcm_handle, -EPIPE);
+      continue;
+    }
+    if (!(revents & POLLOUT)) {
+      continue;
+    }
+
+    snd_pcm_sframes_t available = snd_pcm_avail_update(pcm_handle);
+    if (available < 0) {
+      linux_alsa_recover(pcm_handle, (int)available);
+      continue;
+    }
+
+    while (available > 0) {
+      const uint64_t read_index =
+          ring.read_index.load(std::memory_order_relaxed);
+      const uint32_t queued = (uint32_t)(
+          ring.write_index.load(std::memory_order_acquire) - read_index);
+
+      snd_pcm_sframes_t written;
+      if (queued == 0) {
+        audio->underrun_count.fetch_add(1, std::memory_order_relaxed);
+        const uint32_t silence_count = std::min(
+            {(uint32_t)available, audio->period_sample_count,
+             (uint32_t)(silence.size() / CHANNELS)});
+        written = snd_pcm_writei(pcm_handle, silence.data(), silence_count);
+        if (written < 0) {
+          break;
         }
       } else {
-        // TODO: Log
+        const uint32_t offset = (uint32_t)(read_index & (ring.capacity - 1));
+        const uint32_t count = std::min(
+            {(uint32_t)available, queued, ring.capacity - offset});
+        written = snd_pcm_writei(pcm_handle, ring.samples + offset * CHANNELS,
+                                 count);
+        if (written < 0) {
+          break;
+        }
+        ring.read_index.store(read_index + (uint64_t)written,
+                              std::memory_order_release);
       }
-    } else {
-      // TODO: Log
+      available -= written;
     }
 
-    close(fd);
-  } else {
-    // TODO: Log
+    if (available > 0 && snd_pcm_state(pcm_handle) == SND_PCM_STATE_XRUN) {
+      linux_alsa_recover(pcm_handle, -EPIPE);
+    }
+  }
+
+  return NULL;
+}
+
+static bool linux_start_audio_thread(LinuxAudioThread &audio,
+                                     snd_pcm_t *pcm_handle,
+                                     LinuxAudioRing *ring,
+                                     const uint32_t period_sample_count) {
+  audio.pcm_handle = pcm_handle;
+  audio.ring = ring;
+  audio.period_sample_count = period_sample_count;
+  audio.running = true;
+  audio.underrun_count = 0;
+  if (pthread_create(&audio.thread, NULL, linux_audio_thread_proc, &audio) !=
+      0) {
+    audio.running = false;
+    return false;
+  }
+
+  // NOTE: Best effort, this needs CAP_SYS_NICE or an rtprio limit
+  sched_param param = {};
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+  pthread_setschedparam(audio.thread, SCHED_FIFO, &param);
+
+  return true;
+}
+
+static void linux_stop_audio_thread(LinuxAudioThread &audio) {
+  if (audio.running) {
+    audio.running = false;
+    pthread_join(audio.thread, NULL);
+  }
+}
+
+/*
+ * NOTE: Zero-copy output. The game writes straight into the device's mmap'd
+ * buffer, exactly as many frames as the device has room for; snd_pcm_mmap_begin
+ * hands out at most the frames up to the end of the buffer, so a region that
+ * wraps takes two passes. Returns false if the device had underrun.
+ */
+static bool linux_alsa_mmap_write_game_samples(
+    snd_pcm_t *pcm_handle, GameMemory &game_memory,
+    GameGetSoundSamples *get_sound_samples,
+    const uint32_t samples_per_second) {
+  bool result = true;
+
+  snd_pcm_sframes_t available = snd_pcm_avail_update(pcm_handle);
+  if (available < 0) {
+    result = false;
+    linux_alsa_recover(pcm_handle, (int)available);
+    available = snd_pcm_avail_update(pcm_handle);
+  }
+
+  snd_pcm_uframes_t remaining =
+      available > 0 ? (snd_pcm_uframes_t)available : 0;
+  while (remaining > 0) {
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t frames = remaining;
+    const int error = snd_pcm_mmap_begin(pcm_handle, &areas, &offset, &frames);
+    if (error < 0) {
+      result = false;
+      linux_alsa_recover(pcm_handle, error);
+      break;
+    }
+    if (frames == 0) {
+      break;
+    }
+
+    // NOTE: Interleaved S16 stereo, both channels share the first area
+    ASSERT(areas[0].step == CHANNELS * 16);
+    int16_t *samples = (int16_t *)((uint8_t *)areas[0].addr +
+                                   (areas[0].first + offset * areas[0].step) /
+                                       8);
+    const GameSoundOutputBuffer region{samples_per_second, (uint32_t)frames,
+                                       samples};
+    get_sound_samples(game_memory, region);
+
+    const snd_pcm_sframes_t committed =
+        snd_pcm_mmap_commit(pcm_handle, offset, frames);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+      result = false;
+      linux_alsa_recover(pcm_handle, committed < 0 ? (int)committed : -EPIPE);
+      break;
+    }
+    remaining -= frames;
+  }
+
+  // NOTE: Covers a commit smaller than the start threshold after a recover
+  if (snd_pcm_state(pcm_handle) == SND_PCM_STATE_PREPARED) {
+    snd_pcm_start(pcm_handle);
   }
 
   return result;
 }
 
-static bool DEBUG_platform_write_entire_file(const char *filename,
-                                             uint32_t size, void *content) {
-  bool result = false;
+/*
+ * NOTE: Looped input playback
+ */
 
-  int fd =
-      open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-  if (fd > 0) {
-    if (write(fd, content, size) == (ssize_t)size) {
-      result = true;
-    } else {
-      // TODO: Log
+static bool linux_can_loop_input(const LinuxState &state) {
+  return state.can_snapshot_game_memory;
+}
+
+/*
+ * NOTE: A load still queued when the snapshot is taken would be restored as
+ * queued with nothing left to load it, and one finishing after a restore
+ * would write over the restored memory
+ */
+static void linux_complete_all_queued_work(LinuxState &state) {
+  if (state.work_queues) {
+    linux_complete_all_work(&state.work_queues->high_priority);
+    linux_complete_all_work(&state.work_queues->low_priority);
+  }
+}
+
+/*
+ * NOTE: Writes every page the game has touched into `fd`. Untouched pages are
+ * still holes in the memfd and read back as zeroes.
+ * TODO: Pages swapped out don't show up as resident and are missed
+ */
+static bool linux_write_resident_pages(const LinuxState &state, const int fd) {
+  const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+  const uint64_t page_count = (state.total_size + page_size - 1) / page_size;
+  // NOTE: One byte per page, 270 KB for the default 1 GB + 64 MB block
+  uint8_t *residency = (uint8_t *)mmap(NULL, (size_t)page_count,
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (residency == MAP_FAILED) {
+    return false;
+  }
+
+  uint8_t *base = (uint8_t *)state.game_memory_block;
+  uint64_t copied_page_count = 0;
+  bool result = mincore(base, (size_t)state.total_size, residency) == 0;
+  uint64_t page_index = 0;
+  while (result && page_index < page_count) {
+    if (!(residency[page_index] & 1)) {
+      ++page_index;
+      continue;
     }
-    close(fd);
+
+    // NOTE: Write runs of resident pages in a single call
+    uint64_t run_end = page_index + 1;
+    while (run_end < page_count && (residency[run_end] & 1)) {
+      ++run_end;
+    }
+    const uint64_t offset = page_index * page_size;
+    const uint64_t size =
+        std::min(run_end * page_size, state.total_size) - offset;
+    result =
+        pwrite(fd, base + offset, (size_t)size, (off_t)offset) == (ssize_t)size;
+    copied_page_count += run_end - page_index;
+    page_index = run_end;
+  }
+
+  munmap(residency, (size_t)page_count);
+  if (result) {
+    fprintf(stdout, "Snapshot: %lu pages copied\n", copied_page_count);
+  }
+  return result;
+}
+
+/*
+ * NOTE: The first snapshot creates the memfd and maps it over GameMemory in
+ * place of the anonymous memory it copied. Backing GameMemory with a memfd
+ * from the start would double what every touched page costs (the memfd's
+ * copy and the private one) and turn off transparent huge pages, in every
+ * run rather than only in the ones that loop input.
+ */
+static bool linux_take_game_memory_snapshot(LinuxState &state) {
+  linux_complete_all_queued_work(state);
+  if (state.snapshot_fd >= 0) {
+    return linux_write_resident_pages(state, state.snapshot_fd);
+  }
+
+  const int snapshot_fd = memfd_create("handmade_game_memory", MFD_CLOEXEC);
+  const bool result =
+      snapshot_fd >= 0 &&
+      ftruncate(snapshot_fd, (off_t)state.total_size) == 0 &&
+      linux_write_resident_pages(state, snapshot_fd) &&
+      mmap(state.game_memory_block, (size_t)state.total_size,
+           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, snapshot_fd,
+           0) != MAP_FAILED;
+  if (result) {
+    state.snapshot_fd = snapshot_fd;
   } else {
+    fprintf(stderr, "Can't snapshot game memory into a memfd (%s)\n",
+            strerror(errno));
+    if (snapshot_fd >= 0) {
+      close(snapshot_fd);
+    }
+  }
+  return result;
+}
+
+// NOTE: Returns how long the restore took, in milliseconds
+static double linux_restore_game_memory_snapshot(LinuxState &state) {
+  linux_complete_all_queued_work(state);
+  const timespec start = linux_get_wall_clock();
+  // NOTE: Drops every private (dirtied) page, the mapping reads the memfd
+  // again from here on
+  madvise(state.game_memory_block, (size_t)state.total_size, MADV_DONTNEED);
+  // NOTE: The tile cache went back to the snapshot's frame, but the buffer
+  // the game draws into still holds the loop's last one. Whichever buffer that
+  // is, the next frame redraws and presents all of it.
+  global_backbuffer.contents_lost = true;
+  global_present_everything = true;
+  return (double)linux_get_seconds_elapsed(start, linux_get_wall_clock()) *
+         1000.0;
+}
+
+static void linux_begin_recording_input(LinuxState &state) {
+  ASSERT(linux_can_loop_input(state));
+
+  state.recording_fd = memfd_create("handmade_input", MFD_CLOEXEC);
+  if (state.recording_fd < 0) {
     // TODO: Log
+    return;
   }
 
-  return result;
+  if (!linux_take_game_memory_snapshot(state)) {
+    close(state.recording_fd);
+    state.recording_fd = -1;
+    return;
+  }
+  state.is_recording = true;
 }
 
-static void
-DEBUG_platform_free_file_memory(DEBUGReadFileResult &read_file_result) {
-  munmap(read_file_result.content, read_file_result.content_size);
-  read_file_result.content = NULL;
+static void linux_end_recording_input(LinuxState &state) {
+  state.is_recording = false;
 }
 
-void linux_x11_process_pending_messages(
-    Display *const display, const Window window, const GC gc,
+static double linux_begin_input_playback(LinuxState &state) {
+  lseek(state.recording_fd, 0, SEEK_SET);
+  state.is_playing_back = true;
+  return linux_restore_game_memory_snapshot(state);
+}
+
+static void linux_end_input_playback(LinuxState &state) {
+  state.is_playing_back = false;
+  close(state.recording_fd);
+  state.recording_fd = -1;
+}
+
+static void linux_record_input(LinuxState &state, const GameInput *input) {
+  if (write(state.recording_fd, input, sizeof(*input)) !=
+      (ssize_t)sizeof(*input)) {
+    // TODO: Log
+  }
+}
+
+static void linux_playback_input(LinuxState &state, GameInput *input) {
+  if (read(state.recording_fd, input, sizeof(*input)) !=
+      (ssize_t)sizeof(*input)) {
+    // NOTE: End of the recording, go back to the start
+    linux_begin_input_playback(state);
+    if (read(state.recording_fd, input, sizeof(*input)) !=
+        (ssize_t)sizeof(*input)) {
+      // NOTE: Empty recording
+      linux_end_input_playback(state);
+    }
+  }
+}
+
+/*
+ * NOTE: Record -> loop playback -> stop, on the same key
+ */
+static void linux_toggle_input_looping(LinuxState &state) {
+  if (!linux_can_loop_input(state)) {
+    fprintf(stderr, "Looped playback doesn't support hugetlb game memory\n");
+  } else if (state.is_playing_back) {
+    linux_end_input_playback(state);
+  } else if (state.is_recording) {
+    linux_end_recording_input(state);
+    // NOTE: Only the first restore is reported, the loop restarts every few
+    // seconds and would flood stdout
+    fprintf(stdout, "Snapshot restored in %.3f ms\n",
+            linux_begin_input_playback(state));
+  } else {
+    linux_begin_recording_input(state);
+  }
+}
+
+// NOTE: Returns whether any key events were processed
+static bool linux_x11_process_pending_messages(
+    Display *const display, [[maybe_unused]] LinuxState &state,
     GameControllerInput *keyboard_controller) {
+  bool got_input = false;
   while (XPending(display)) {
     XEvent event;
     XNextEvent(display, &event);
     switch (event.type) {
     case ConfigureNotify: {
-      linux_x11_resize_bitmap(global_backbuffer,
-                              (uint32_t)event.xconfigure.width,
-                              (uint32_t)event.xconfigure.height);
+      // NOTE: Also sent for moves, and dozens of times a second while the
+      // window is being resized
+      global_pending_window_dimension = LinuxWindowDimension{
+          (uint32_t)event.xconfigure.width, (uint32_t)event.xconfigure.height};
     } break;
     case Expose: {
-      const LinuxWindowDimension dimension =
-          linux_x11_get_window_dimension(display, window);
-      linux_x11_display_buffer_in_window(display, window, gc, global_backbuffer,
-                                         dimension.width, dimension.height);
+      global_present_everything = true;
     } break;
     case ClientMessage: {
       running = false;
@@ -253,6 +990,7 @@ void linux_x11_process_pending_messages(
     } break;
     case KeyPress:
     case KeyRelease: {
+      got_input = true;
       const bool just_released = event.xkey.type == KeyRelease;
       bool is_down = event.xkey.type == KeyPress;
       if (event.xkey.type == KeyRelease && XPending(display)) {
@@ -311,29 +1049,529 @@ void linux_x11_process_pending_messages(
         } break;
         case XK_space: {
         } break;
+#if HANDMADE_INTERNAL
+        case 'l': {
+          if (is_down) {
+            linux_toggle_input_looping(state);
+          }
+        } break;
+        case 'p': {
+          if (is_down) {
+            global_write_debug_trace = true;
+          }
+        } break;
+#endif
         }
       }
     } break;
-    default:
-      break;
+    default: {
+      if (global_shm_available &&
+          event.type == global_shm_completion_event) {
+        global_backbuffer.shm_put_pending = false;
+      }
+    } break;
+    }
+  }
+
+  return got_input;
+}
+
+/*
+ * NOTE: Evdev controller
+ */
+
+// NOTE: Returns whether any events were processed
+static bool
+linux_evdev_process_events(libevdev *const evdev,
+                           const GameControllerInput *old_controller,
+                           GameControllerInput *new_controller,
+                           bool &dpad_x_active, bool &dpad_y_active) {
+  bool got_input = false;
+  // TODO: Maybe use (rc == 1 || rc == 0 || rc == -EAGAIN) and check
+  // if(rc == o) before using the event
+  input_event input_event;
+  while (libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &input_event) ==
+         0) {
+    got_input = true;
+    if (input_event.type == EV_KEY) {
+      linux_process_evdev_digital_button(
+          input_event, &old_controller->action_left, BTN_WEST,
+          &new_controller->action_left);
+      linux_process_evdev_digital_button(
+          input_event, &old_controller->action_right, BTN_EAST,
+          &new_controller->action_right);
+      linux_process_evdev_digital_button(
+          input_event, &old_controller->action_up, BTN_NORTH,
+          &new_controller->action_up);
+      linux_process_evdev_digital_button(
+          input_event, &old_controller->action_down, BTN_SOUTH,
+          &new_controller->action_down);
+      linux_process_evdev_digital_button(
+          input_event, &old_controller->left_shoulder, BTN_TL,
+          &new_controller->left_shoulder);
+      linux_process_evdev_digital_button(
+          input_event, &old_controller->right_shoulder, BTN_TR,
+          &new_controller->right_shoulder);
+    } else if (input_event.type == EV_ABS) {
+      constexpr int32_t DEADZONE = 3;
+      switch (input_event.code) {
+      case ABS_X: {
+        if (!dpad_x_active) {
+          new_controller->stick_average_x =
+              linux_process_evdev_stick_value(input_event.value, DEADZONE);
+        }
+      } break;
+      case ABS_HAT0X: {
+        if (input_event.value == 0) {
+          dpad_x_active = false;
+        } else {
+          dpad_x_active = true;
+        }
+        new_controller->stick_average_x = (float)input_event.value;
+      } break;
+      case ABS_Y: {
+        if (!dpad_y_active) {
+          new_controller->stick_average_y =
+              linux_process_evdev_stick_value(input_event.value, DEADZONE);
+        }
+      } break;
+      case ABS_HAT0Y: {
+        if (input_event.value == 0) {
+          dpad_y_active = false;
+        } else {
+          dpad_y_active = true;
+        }
+        new_controller->stick_average_y = (float)input_event.value;
+      } break;
+      }
+    }
+  }
+
+  return got_input;
+}
+
+// NOTE: The move buttons follow the stick, once it's settled for the frame
+static void
+linux_evdev_update_move_buttons(const GameControllerInput *old_controller,
+                                GameControllerInput *new_controller) {
+  constexpr float THRESHOLD = 0.5;
+  struct input_event fake_move_event = {
+      {}, 0, 0, (new_controller->stick_average_x < -THRESHOLD) ? 1 : 0};
+  linux_process_evdev_digital_button(fake_move_event,
+                                     &old_controller->move_left, 0,
+                                     &new_controller->move_left);
+  fake_move_event.value = (new_controller->stick_average_x > THRESHOLD) ? 1 : 0;
+  linux_process_evdev_digital_button(fake_move_event,
+                                     &old_controller->move_right, 0,
+                                     &new_controller->move_right);
+  fake_move_event.value =
+      (new_controller->stick_average_y < -THRESHOLD) ? 1 : 0;
+  linux_process_evdev_digital_button(fake_move_event, &old_controller->move_up,
+                                     0, &new_controller->move_up);
+  fake_move_event.value = (new_controller->stick_average_y > THRESHOLD) ? 1 : 0;
+  linux_process_evdev_digital_button(fake_move_event,
+                                     &old_controller->move_down, 0,
+                                     &new_controller->move_down);
+}
+
+// NOTE: Buttons stay down until released, transitions start from zero
+static void linux_begin_input_frame(GameInput *new_input,
+                                    GameInput *old_input) {
+  GameControllerInput *keyboard_controller = get_controller(new_input, 0);
+  *keyboard_controller = {};
+  keyboard_controller->is_connected = true;
+  for (uint32_t controller_index = 0;
+       controller_index < new_input->controllers.size(); ++controller_index) {
+    GameControllerInput *const new_controller =
+        get_controller(new_input, controller_index);
+    const GameControllerInput *const old_controller =
+        get_controller(old_input, controller_index);
+
+    for (uint32_t button_index = 0;
+         button_index < new_controller->buttons.size(); ++button_index) {
+      new_controller->buttons[button_index].ended_down =
+          old_controller->buttons[button_index].ended_down;
+      new_controller->stick_average_x = old_controller->stick_average_x;
+      new_controller->stick_average_y = old_controller->stick_average_y;
+    }
+  }
+}
+
+/*
+ * NOTE: Event loop. Between frames the main thread sleeps in a single epoll
+ * wait on everything that can wake it up, and handles each event as soon as
+ * it arrives.
+ */
+
+static bool linux_init_event_loop(LinuxEventLoop &loop, Display *const display,
+                                  libevdev *const controller_evdev,
+                                  snd_pcm_t *const mmap_pcm_handle) {
+  loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop.epoll_fd < 0) {
+    return false;
+  }
+
+  bool result = true;
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = (uint64_t)LinuxEventSource::X11 << 32;
+  result &= epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, ConnectionNumber(display),
+                      &event) == 0;
+  if (controller_evdev) {
+    event.data.u64 = (uint64_t)LinuxEventSource::Evdev << 32;
+    result &= epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD,
+                        libevdev_get_fd(controller_evdev), &event) == 0;
+  }
+
+  loop.alsa_pcm_handle = mmap_pcm_handle;
+  loop.alsa_poll_fd_count = 0;
+  if (mmap_pcm_handle) {
+    loop.alsa_poll_fd_count = (uint32_t)std::clamp(
+        snd_pcm_poll_descriptors_count(mmap_pcm_handle), 0,
+        (int)loop.alsa_poll_fds.size());
+    snd_pcm_poll_descriptors(mmap_pcm_handle, loop.alsa_poll_fds.data(),
+                             loop.alsa_poll_fd_count);
+    for (uint32_t i = 0; i < loop.alsa_poll_fd_count; ++i) {
+      event.events = (uint32_t)loop.alsa_poll_fds[i].events;
+      event.data.u64 = ((uint64_t)LinuxEventSource::Alsa << 32) | i;
+      result &= epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD,
+                          loop.alsa_poll_fds[i].fd, &event) == 0;
+    }
+  }
+
+  return result;
+}
+
+/*
+ * NOTE: Waits up to `timeout_nanoseconds` for any source to become ready,
+ * returns a mask of (1 << LinuxEventSource) for the ones that are
+ */
+static uint32_t linux_wait_for_events(LinuxEventLoop &loop,
+                                      const uint64_t timeout_nanoseconds) {
+  std::array<epoll_event, 16> events;
+  const timespec timeout{(time_t)(timeout_nanoseconds / 1000000000ull),
+                         (long)(timeout_nanoseconds % 1000000000ull)};
+  int event_count = epoll_pwait2(loop.epoll_fd, events.data(),
+                                 (int)events.size(), &timeout, NULL);
+  if (event_count < 0 && errno == ENOSYS) {
+    // NOTE: Kernels before 5.11, only millisecond timeouts
+    event_count = epoll_wait(
+        loop.epoll_fd, events.data(), (int)events.size(),
+        (int)((timeout_nanoseconds + 999999) / 1000000));
+  }
+
+  uint32_t result = 0;
+  bool alsa_is_ready = false;
+  for (int i = 0; i < event_count; ++i) {
+    const LinuxEventSource source =
+        (LinuxEventSource)(events[i].data.u64 >> 32);
+    if (source == LinuxEventSource::Alsa) {
+      const uint32_t index = (uint32_t)events[i].data.u64;
+      loop.alsa_poll_fds[index].revents = (short)events[i].events;
+      alsa_is_ready = true;
+    } else {
+      result |= 1u << (uint32_t)source;
     }
   }
+
+  // NOTE: The PCM's descriptors don't map to POLLOUT directly, ALSA has to
+  // translate them
+  if (alsa_is_ready) {
+    unsigned short revents = 0;
+    snd_pcm_poll_descriptors_revents(loop.alsa_pcm_handle,
+                                     loop.alsa_poll_fds.data(),
+                                     loop.alsa_poll_fd_count, &revents);
+    if (revents & (POLLOUT | POLLERR)) {
+      result |= 1u << (uint32_t)LinuxEventSource::Alsa;
+    }
+    for (uint32_t i = 0; i < loop.alsa_poll_fd_count; ++i) {
+      loop.alsa_poll_fds[i].revents = 0;
+    }
+  }
+
+  return result;
 }
 
-static timespec linux_get_wall_clock() {
+/*
+ * NOTE: Not CLOCK_MONOTONIC_RAW like linux_get_wall_clock, timers can't sleep
+ * on it
+ */
+static uint64_t linux_get_monotonic_nanoseconds() {
   timespec result;
-  clock_gettime(CLOCK_MONOTONIC_RAW, &result);
+  clock_gettime(CLOCK_MONOTONIC, &result);
+  return (uint64_t)result.tv_sec * 1000000000ull + (uint64_t)result.tv_nsec;
+}
+
+static uint32_t linux_get_frame_histogram_bucket(const uint64_t nanoseconds) {
+  const uint64_t microseconds = nanoseconds / 1000;
+  uint32_t result = 0;
+  while (result < LINUX_FRAME_HISTOGRAM_BUCKET_COUNT - 1 &&
+         (1ull << result) <= microseconds) {
+    ++result;
+  }
   return result;
 }
 
-static float linux_get_seconds_elapsed(timespec start, timespec end) {
-  float result =
-      (float)((end.tv_sec - start.tv_sec)) +
-      ((float)(end.tv_nsec - start.tv_nsec) / (1000.0f * 1000.0f * 1000.0f));
+static void linux_init_frame_pacer(LinuxFramePacer &pacer,
+                                   const uint64_t target_nanoseconds) {
+  pacer = {};
+  pacer.target_nanoseconds = target_nanoseconds;
+  pacer.spin_nanoseconds =
+      std::min(LINUX_FRAME_PACER_SPIN_NANOSECONDS, target_nanoseconds / 4);
+  pacer.last_frame_end = linux_get_monotonic_nanoseconds();
+  pacer.last_deadline = pacer.last_frame_end;
+  pacer.deadline = pacer.last_frame_end + target_nanoseconds;
+}
+
+/*
+ * NOTE: Called once the frame's work is done. A frame that missed its deadline
+ * ends right away, and the following ones are paced from there instead of
+ * rushing to catch up.
+ */
+static void linux_check_frame_deadline(LinuxFramePacer &pacer) {
+  const uint64_t now = linux_get_monotonic_nanoseconds();
+  if (now > pacer.deadline) {
+    ++pacer.missed_deadline_count;
+    ++pacer.missed_histogram[linux_get_frame_histogram_bucket(
+        now - pacer.deadline)];
+    pacer.deadline = now;
+  }
+}
+
+// NOTE: When the frame's waiting for events should stop and the spin start
+static uint64_t linux_get_frame_spin_start(const LinuxFramePacer &pacer) {
+  return pacer.deadline - pacer.spin_nanoseconds;
+}
+
+/*
+ * NOTE: Returns how long the frame was by its deadlines, which is exactly the
+ * target unless it missed its deadline. The simulation is advanced by that
+ * rather than by the measured length, so the wait's jitter doesn't make
+ * frames alternate between one update too few and one too many.
+ */
+static uint64_t linux_wait_for_frame_deadline(LinuxFramePacer &pacer) {
+  const uint64_t spin_start = linux_get_frame_spin_start(pacer);
+  if (linux_get_monotonic_nanoseconds() < spin_start) {
+    const timespec wake_time{(time_t)(spin_start / 1000000000ull),
+                             (long)(spin_start % 1000000000ull)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time,
+                           NULL) == EINTR) {
+    }
+  }
+  uint64_t now = linux_get_monotonic_nanoseconds();
+  while (now < pacer.deadline) {
+    _mm_pause();
+    now = linux_get_monotonic_nanoseconds();
+  }
+
+  const uint64_t frame_length = now - pacer.last_frame_end;
+  const uint64_t jitter = frame_length > pacer.target_nanoseconds
+                              ? frame_length - pacer.target_nanoseconds
+                              : pacer.target_nanoseconds - frame_length;
+  ++pacer.jitter_histogram[linux_get_frame_histogram_bucket(jitter)];
+  ++pacer.frame_count;
+  pacer.last_frame_end = now;
+  const uint64_t result = pacer.deadline - pacer.last_deadline;
+  pacer.last_deadline = pacer.deadline;
+  pacer.deadline += pacer.target_nanoseconds;
   return result;
 }
 
-int main() {
+static void
+linux_print_frame_histogram(const char *name,
+                            const std::array<uint64_t,
+                                             LINUX_FRAME_HISTOGRAM_BUCKET_COUNT>
+                                &histogram) {
+  fprintf(stdout, "  %s:\n", name);
+  for (uint32_t i = 0; i < histogram.size(); ++i) {
+    if (histogram[i]) {
+      if (i + 1 < histogram.size()) {
+        fprintf(stdout, "    < %6llu us: %lu\n", 1ull << i, histogram[i]);
+      } else {
+        fprintf(stdout, "   >= %6llu us: %lu\n", 1ull << (i - 1),
+                histogram[i]);
+      }
+    }
+  }
+}
+
+static void linux_print_frame_pacer_stats(const LinuxFramePacer &pacer) {
+  fprintf(stdout, "frames: %lu at %.3f ms, %lu missed their deadline\n",
+          pacer.frame_count, (double)pacer.target_nanoseconds / 1000000.0,
+          pacer.missed_deadline_count);
+  linux_print_frame_histogram("frame length off the target by",
+                              pacer.jitter_histogram);
+  if (pacer.missed_deadline_count) {
+    linux_print_frame_histogram("deadline missed by",
+                                pacer.missed_histogram);
+  }
+}
+
+static void
+linux_count_frame_page_faults(LinuxFramePageFaults &stats,
+                              const LinuxPageFaultCounts page_faults) {
+  ++stats.frame_count;
+  stats.minor_count += page_faults.minor;
+  stats.major_count += page_faults.major;
+  const uint64_t fault_count = page_faults.minor + page_faults.major;
+  uint32_t bucket = 0;
+  while (bucket < LINUX_PAGE_FAULT_HISTOGRAM_BUCKET_COUNT - 1 &&
+         (1ull << bucket) <= fault_count) {
+    ++bucket;
+  }
+  ++stats.histogram[bucket];
+}
+
+static void linux_print_frame_page_faults(const LinuxFramePageFaults &stats) {
+  fprintf(stdout, "page faults: %lu minor / %lu major over %lu frames\n",
+          stats.minor_count, stats.major_count, stats.frame_count);
+  if (stats.minor_count || stats.major_count) {
+    fprintf(stdout, "  faults per frame:\n");
+    for (uint32_t i = 0; i < stats.histogram.size(); ++i) {
+      if (stats.histogram[i]) {
+        if (i + 1 < stats.histogram.size()) {
+          fprintf(stdout, "    < %6llu: %lu\n", 1ull << i,
+                  stats.histogram[i]);
+        } else {
+          fprintf(stdout, "   >= %6llu: %lu\n", 1ull << (i - 1),
+                  stats.histogram[i]);
+        }
+      }
+    }
+  }
+}
+
+static void linux_game_update_stub(GameInput *, GameMemory &) {}
+
+static void linux_game_render_stub(const GameOffscreenBuffer &, GameMemory &,
+                                   float) {}
+
+static void
+linux_game_get_sound_samples_stub(GameMemory &,
+                                  const GameSoundOutputBuffer &sound_buffer) {
+  memset(sound_buffer.samples, 0,
+         sound_buffer.sample_count * CHANNELS * sizeof(int16_t));
+}
+
+// NOTE: libhandmade.so in the executable's directory
+static bool linux_get_game_library_path(char *path, const size_t size) {
+  const ssize_t length = readlink("/proc/self/exe", path, size - 1);
+  if (length <= 0) {
+    return false;
+  }
+  path[length] = '\0';
+  char *last_slash = strrchr(path, '/');
+  const size_t directory_length =
+      last_slash ? (size_t)(last_slash - path) + 1 : 0;
+  return snprintf(path + directory_length, size - directory_length,
+                  "libhandmade.so") < (int)(size - directory_length);
+}
+
+static void linux_unload_game_code(LinuxGameCode &game) {
+  if (game.library) {
+    dlclose(game.library);
+    game.library = NULL;
+  }
+  game.update = linux_game_update_stub;
+  game.render = linux_game_render_stub;
+  game.get_sound_samples = linux_game_get_sound_samples_stub;
+}
+
+static bool linux_game_code_changed(const LinuxGameCode &game,
+                                    const char *path) {
+  struct stat file_stat;
+  return stat(path, &file_stat) == 0 &&
+         (file_stat.st_ino != game.inode ||
+          file_stat.st_mtim.tv_sec != game.last_write_time.tv_sec ||
+          file_stat.st_mtim.tv_nsec != game.last_write_time.tv_nsec);
+}
+
+/*
+ * NOTE: The previous library has to be unloaded first, dlopen hands back the
+ * one already loaded from the same path otherwise. On failure the stubs stay
+ * in place until the file changes again.
+ */
+static bool linux_load_game_code(LinuxGameCode &game, const char *path) {
+  linux_unload_game_code(game);
+
+  // NOTE: Statted before it's opened, if it's replaced in between it just
+  // gets loaded again on the next check
+  struct stat file_stat;
+  if (stat(path, &file_stat) != 0) {
+    linux_log_file_error(path, "stat");
+    return false;
+  }
+  game.last_write_time = file_stat.st_mtim;
+  game.inode = file_stat.st_ino;
+
+  void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!library) {
+    fprintf(stderr, "%s\n", dlerror());
+    return false;
+  }
+  GameUpdate *update = (GameUpdate *)dlsym(library, "game_update");
+  GameRender *render = (GameRender *)dlsym(library, "game_render");
+  GameGetSoundSamples *get_sound_samples =
+      (GameGetSoundSamples *)dlsym(library, "game_get_sound_samples");
+  if (!update || !render || !get_sound_samples) {
+    fprintf(stderr, "%s: missing the game's entry points\n", path);
+    dlclose(library);
+    return false;
+  }
+
+  game.library = library;
+  game.update = update;
+  game.render = render;
+  game.get_sound_samples = get_sound_samples;
+  return true;
+}
+
+#if HANDMADE_INTERNAL
+/*
+ * NOTE: Drops every event and tally, the names they point at may have gone
+ * with the game code that recorded them. Only safe while no other thread is
+ * recording.
+ */
+static void linux_reset_debug_table(DebugTable &table) {
+  for (DebugThread &thread : table.threads) {
+    thread.write_index.store(0, std::memory_order_relaxed);
+    thread.read_index = 0;
+    thread.open_block_count = 0;
+  }
+  table.last_frame.block_count = 0;
+  table.accumulated.frame_count = 0;
+  table.accumulated.block_count = 0;
+}
+#endif
+
+int main(int argc, char **argv) {
+  LinuxMemoryOptions memory_options = {};
+  bool use_alsa_mmap = false;
+  // NOTE: With a fixed resolution the game always renders at that size and
+  // the result is stretched to the window, otherwise it renders at the
+  // window's size
+  uint32_t fixed_width = 0;
+  uint32_t fixed_height = 0;
+  bool use_bilinear_scaling = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--alsa-mmap") == 0) {
+      use_alsa_mmap = true;
+    } else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc &&
+               sscanf(argv[i + 1], "%ux%u", &fixed_width, &fixed_height) ==
+                   2 &&
+               fixed_width >= 2 && fixed_height >= 2) {
+      ++i;
+    } else if (strcmp(argv[i], "--bilinear") == 0) {
+      use_bilinear_scaling = true;
+    } else if (!linux_parse_memory_option(argv[i], memory_options)) {
+      fprintf(stderr,
+              "Usage: %s [--hugetlb] [--thp] [--prefault] [--alsa-mmap] "
+              "[--resolution WxH [--bilinear]]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
   Display *const display = XOpenDisplay(NULL);
   if (display) {
     const int screen = DefaultScreen(display);
@@ -355,10 +1593,16 @@ int main() {
       }
     }
 
-    // TODO: Reliably query this on Linux
-    constexpr uint32_t monitor_refresh_hz = 60;
-    constexpr uint32_t game_update_hz = monitor_refresh_hz / 2;
-    constexpr float target_seconds_per_frame = 1.0f / (float)game_update_hz;
+    // NOTE: A frame every refresh, the simulation keeps its own rate
+    float monitor_refresh_hz = linux_x11_get_refresh_rate(display, window);
+    if (monitor_refresh_hz < 1.0f) {
+      // TODO: Log that we are assuming 60Hz
+      monitor_refresh_hz = 60.0f;
+    }
+    const uint64_t target_nanoseconds_per_frame =
+        (uint64_t)(1000000000.0 / (double)monitor_refresh_hz);
+    const uint32_t frame_hz =
+        std::max(1u, (uint32_t)lroundf(monitor_refresh_hz));
 
     if (XMapWindow(display, window) == 0) {
       // TODO: Log error
@@ -367,7 +1611,22 @@ int main() {
     }
     const GC gc = XCreateGC(display, window, 0, NULL);
 
-    linux_x11_resize_bitmap(global_backbuffer, 800, 600);
+    linux_x11_init_shm(display);
+    linux_x11_resize_bitmap(display, global_backbuffer, 800, 600);
+
+    GameOffscreenBuffer game_buffer = {};
+    if (fixed_width) {
+      const uint32_t pitch = fixed_width * sizeof(uint32_t);
+      void *memory =
+          mmap(NULL, (size_t)pitch * fixed_height, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory != MAP_FAILED) {
+        game_buffer = GameOffscreenBuffer{memory, fixed_width, fixed_height,
+                                          pitch};
+      } else {
+        // TODO: Log that we are rendering at the window's size instead
+      }
+    }
 
     libevdev *controller_evdev = NULL;
     int controller_found = -1;
@@ -403,40 +1662,75 @@ int main() {
       }
     }
 
+    // NOTE: The game writes once per frame, so the ring has to cover a whole
+    // frame plus the device's two periods to never run dry
+    constexpr uint32_t samples_per_second = 48000;
+    constexpr uint32_t period_sample_count = 256;
     LinuxSoundOutput sound_output{
-        48000,
-        48000 / 15,
+        samples_per_second,
+        period_sample_count,
+        samples_per_second / frame_hz + 2 * period_sample_count,
+        use_alsa_mmap,
     };
 
-    linux_alsa_init((uint32_t)sound_output.samples_per_second,
-                    (uint32_t)sound_output.samples_per_write);
-
+    LinuxAudioRing audio_ring = {};
+    audio_ring.capacity = 8192;
+    ASSERT(sound_output.target_queued_sample_count <= audio_ring.capacity);
     // TODO: Pool with the bitmap image allocation
     int16_t *samples = static_cast<int16_t *>(
-        mmap(NULL, sound_output.samples_per_write * CHANNELS * sizeof(int16_t),
+        mmap(NULL, audio_ring.capacity * CHANNELS * sizeof(int16_t),
              PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
-    GameMemory game_memory{
-        false, MEGABYTES(64), NULL, GIGABYTES(1), NULL,
-    };
+    audio_ring.samples = samples;
 
-#if HANDMADE_INTERNAL
-    void *address = (void *)TERABYTES(1);
-#else
-    void *address = 0;
-#endif
+    GameMemory game_memory = {};
+    game_memory.permanent_storage_size = MEGABYTES(64);
+    game_memory.transient_storage_size = GIGABYTES(1);
 
-    uint64_t total_size =
-        game_memory.permanent_storage_size + game_memory.transient_storage_size;
-    game_memory.permanent_storage =
-        mmap(address, (size_t)total_size, PROT_READ | PROT_WRITE,
-             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    game_memory.transient_storage = (uint8_t *)game_memory.permanent_storage +
-                                    game_memory.permanent_storage_size;
+    static LinuxWorkQueues work_queues;
+    linux_make_work_queues(&work_queues,
+                           linux_get_default_worker_thread_count());
+    game_memory.high_priority_queue = &work_queues.high_priority;
+    game_memory.low_priority_queue = &work_queues.low_priority;
 
-    if (samples && game_memory.permanent_storage &&
-        game_memory.transient_storage) {
+    char game_library_path[PATH_MAX];
+    if (!linux_get_game_library_path(game_library_path,
+                                     sizeof(game_library_path))) {
+      // TODO: Log error
+      return 1;
+    }
+    // NOTE: Without the library the game just doesn't run until it shows up
+    LinuxGameCode game_code = {};
+    linux_load_game_code(game_code, game_library_path);
+    game_memory.platform_add_entry = linux_add_entry;
+    game_memory.platform_complete_all_work = linux_complete_all_work;
+    game_memory.platform_open_file = linux_open_file;
+    game_memory.platform_read_data_from_file = linux_read_data_from_file;
+    game_memory.platform_close_file = linux_close_file;
+#if HANDMADE_INTERNAL
+    game_memory.DEBUG_platform_write_entire_file =
+        DEBUG_platform_write_entire_file;
+    game_memory.debug_table = linux_allocate_debug_table();
+    debug_global_table = game_memory.debug_table;
+#endif
 
-      linux_alsa_fill_sound_buffer(samples, sound_output.samples_per_write);
+    LinuxState linux_state = {};
+    linux_state.work_queues = &work_queues;
+    if (samples != MAP_FAILED &&
+        linux_allocate_game_memory(linux_state, game_memory, memory_options)) {
+      static LinuxAudioThread audio_thread;
+      snd_pcm_t *pcm_handle = linux_alsa_init(
+          sound_output.samples_per_second, sound_output.period_sample_count,
+          sound_output.target_queued_sample_count, sound_output.use_mmap);
+      uint32_t mmap_underrun_count = 0;
+      if (pcm_handle) {
+        if (!sound_output.use_mmap &&
+            !linux_start_audio_thread(audio_thread, pcm_handle, &audio_ring,
+                                      sound_output.period_sample_count)) {
+          // TODO: Log
+        }
+      } else {
+        // TODO: Log, we are running without sound
+      }
 
       GameInput input[2] = {};
       GameInput *new_input = &input[0];
@@ -447,174 +1741,291 @@ int main() {
 
       running = true;
 
-      timespec last_counter = linux_get_wall_clock();
-      uint64_t last_cycle_count = __rdtsc();
+      LinuxPageFaultCounts last_page_faults = linux_get_page_fault_counts();
+      LinuxFramePageFaults frame_page_faults = {};
 
+      LinuxEventLoop event_loop = {};
+      if (!linux_init_event_loop(
+              event_loop, display,
+              controller_found >= 0 ? controller_evdev : NULL,
+              sound_output.use_mmap ? pcm_handle : NULL)) {
+        // TODO: Log, some events will only be seen at the start of a frame
+      }
+      // NOTE: When the oldest input the game hasn't seen yet arrived
+      bool has_pending_input = false;
+      timespec pending_input_time = {};
+      LinuxInputLatency input_latency = {};
+
+      // NOTE: The spin at the end of every frame counts on sleeps not
+      // overshooting by more than it, so use the smallest slack there is
+      prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+      LinuxFramePacer pacer;
+      linux_init_frame_pacer(pacer, target_nanoseconds_per_frame);
+      LinuxUpdateClock update_clock = {};
+      uint64_t frame_nanoseconds = target_nanoseconds_per_frame;
+
+      constexpr uint32_t controller_index = 1; // 0 is the keyboard
+      linux_begin_input_frame(new_input, old_input);
       while (running) {
         GameControllerInput *keyboard_controller = get_controller(new_input, 0);
-        *keyboard_controller = {};
-        keyboard_controller->is_connected = true;
-        for (uint32_t controller_index = 0;
-             controller_index < new_input->controllers.size();
-             ++controller_index) {
-          GameControllerInput *const new_controller =
-              get_controller(new_input, controller_index);
-          const GameControllerInput *const old_controller =
-              get_controller(old_input, controller_index);
-
-          for (uint32_t button_index = 0;
-               button_index < new_controller->buttons.size(); ++button_index) {
-            new_controller->buttons[button_index].ended_down =
-                old_controller->buttons[button_index].ended_down;
-            new_controller->stick_average_x = old_controller->stick_average_x;
-            new_controller->stick_average_y = old_controller->stick_average_y;
+        GameControllerInput *old_controller =
+            get_controller(old_input, controller_index);
+        GameControllerInput *new_controller =
+            get_controller(new_input, controller_index);
+
+        if (linux_game_code_changed(game_code, game_library_path)) {
+          const timespec reload_start = linux_get_wall_clock();
+          // NOTE: Queued work points at the old code
+          linux_complete_all_work(&work_queues.high_priority);
+          linux_complete_all_work(&work_queues.low_priority);
+#if HANDMADE_INTERNAL
+          if (game_memory.debug_table) {
+            linux_reset_debug_table(*game_memory.debug_table);
+          }
+#endif
+          if (linux_load_game_code(game_code, game_library_path)) {
+            fprintf(stdout, "game code reloaded in %.2f ms\n",
+                    (double)linux_get_seconds_elapsed(reload_start,
+                                                      linux_get_wall_clock()) *
+                        1000.0);
           }
         }
 
-        linux_x11_process_pending_messages(display, window, gc,
-                                           keyboard_controller);
+        BEGIN_TIMED_BLOCK("input");
+        // NOTE: Anything that arrived after the previous frame's wait ended
+        bool got_input = linux_x11_process_pending_messages(
+            display, linux_state, keyboard_controller);
+        if (controller_found >= 0) {
+          got_input |= linux_evdev_process_events(
+              controller_evdev, old_controller, new_controller,
+              dpad_x_active, dpad_y_active);
+        }
+        if (got_input && !has_pending_input) {
+          has_pending_input = true;
+          pending_input_time = linux_get_wall_clock();
+        }
+
+        // NOTE: In fixed resolution mode the game's buffer never changes,
+        // only the one it's stretched into
+        const LinuxWindowDimension window_dimension =
+            global_pending_window_dimension;
+        if (window_dimension.width && window_dimension.height &&
+            (window_dimension.width != global_backbuffer.width ||
+             window_dimension.height != global_backbuffer.height)) {
+          linux_x11_resize_bitmap(display, global_backbuffer,
+                                  window_dimension.width,
+                                  window_dimension.height);
+          if (game_buffer.memory) {
+            global_backbuffer.contents_lost = false;
+            global_present_everything = true;
+          }
+        }
 
         if (controller_found >= 0) {
-          constexpr uint32_t controller_index = 1; // 0 is the keyboard
-          input_event input_event;
-          GameControllerInput *old_controller =
-              get_controller(old_input, controller_index);
-          GameControllerInput *new_controller =
-              get_controller(new_input, controller_index);
           new_controller->is_analog = true;
           new_controller->is_connected = true;
-          // TODO: Maybe use (rc == 1 || rc == 0 || rc == -EAGAIN) and check
-          // if(rc == o) before using the event
-          while (libevdev_next_event(controller_evdev,
-                                     LIBEVDEV_READ_FLAG_NORMAL,
-                                     &input_event) == 0) {
-            if (input_event.type == EV_KEY) {
-              linux_process_evdev_digital_button(
-                  input_event, &old_controller->action_left, BTN_WEST,
-                  &new_controller->action_left);
-              linux_process_evdev_digital_button(
-                  input_event, &old_controller->action_right, BTN_EAST,
-                  &new_controller->action_right);
-              linux_process_evdev_digital_button(
-                  input_event, &old_controller->action_up, BTN_NORTH,
-                  &new_controller->action_up);
-              linux_process_evdev_digital_button(
-                  input_event, &old_controller->action_down, BTN_SOUTH,
-                  &new_controller->action_down);
-              linux_process_evdev_digital_button(
-                  input_event, &old_controller->left_shoulder, BTN_TL,
-                  &new_controller->left_shoulder);
-              linux_process_evdev_digital_button(
-                  input_event, &old_controller->right_shoulder, BTN_TR,
-                  &new_controller->right_shoulder);
-            } else if (input_event.type == EV_ABS) {
-              constexpr int32_t DEADZONE = 3;
-              switch (input_event.code) {
-              case ABS_X: {
-                if (!dpad_x_active) {
-                  new_controller->stick_average_x =
-                      linux_process_evdev_stick_value(input_event.value,
-                                                      DEADZONE);
-                }
-              } break;
-              case ABS_HAT0X: {
-                if (input_event.value == 0) {
-                  dpad_x_active = false;
-                } else {
-                  dpad_x_active = true;
-                }
-                new_controller->stick_average_x = (float)input_event.value;
-              } break;
-              case ABS_Y: {
-                if (!dpad_y_active) {
-                  new_controller->stick_average_y =
-                      linux_process_evdev_stick_value(input_event.value,
-                                                      DEADZONE);
-                }
-              } break;
-              case ABS_HAT0Y: {
-                if (input_event.value == 0) {
-                  dpad_y_active = false;
-                } else {
-                  dpad_y_active = true;
-                }
-                new_controller->stick_average_y = (float)input_event.value;
-              } break;
-              }
-            }
-          }
-          constexpr float THRESHOLD = 0.5;
-          struct input_event fake_move_event = {
-              {}, 0, 0, (new_controller->stick_average_x < -THRESHOLD) ? 1 : 0};
-          linux_process_evdev_digital_button(fake_move_event,
-                                             &old_controller->move_left, 0,
-                                             &new_controller->move_left);
-          fake_move_event.value =
-              (new_controller->stick_average_x > THRESHOLD) ? 1 : 0;
-          linux_process_evdev_digital_button(fake_move_event,
-                                             &old_controller->move_right, 0,
-                                             &new_controller->move_right);
-          fake_move_event.value =
-              (new_controller->stick_average_y < -THRESHOLD) ? 1 : 0;
-          linux_process_evdev_digital_button(fake_move_event,
-                                             &old_controller->move_up, 0,
-                                             &new_controller->move_up);
-          fake_move_event.value =
-              (new_controller->stick_average_y > THRESHOLD) ? 1 : 0;
-          linux_process_evdev_digital_button(fake_move_event,
-                                             &old_controller->move_down, 0,
-                                             &new_controller->move_down);
+          linux_evdev_update_move_buttons(old_controller, new_controller);
         }
 
-        const GameOffscreenBuffer buffer{
+        const GameOffscreenBuffer window_buffer{
             global_backbuffer.memory, global_backbuffer.width,
             global_backbuffer.height, global_backbuffer.pitch};
-        const GameSoundOutputBuffer sound_buffer{
-            sound_output.samples_per_second,
-            linux_alsa_get_samples_to_write(sound_output.samples_per_write),
-            samples,
-        };
-        game_update_and_render(new_input, buffer, sound_buffer, game_memory);
+        const GameOffscreenBuffer &buffer =
+            game_buffer.memory ? game_buffer : window_buffer;
+        if (!game_buffer.memory) {
+          linux_x11_wait_for_shm_put(display, global_backbuffer);
+        }
 
-        linux_alsa_fill_sound_buffer(sound_buffer.samples,
-                                     sound_buffer.sample_count);
+        END_TIMED_BLOCK("input");
+
+        const uint32_t update_count =
+            linux_advance_update_clock(update_clock, frame_nanoseconds);
+        if (update_count > 0 && has_pending_input) {
+          const uint64_t latency = linux_get_nanoseconds_elapsed(
+              pending_input_time, linux_get_wall_clock());
+          ++input_latency.frame_count;
+          input_latency.total_nanoseconds += latency;
+          input_latency.max_nanoseconds =
+              std::max(input_latency.max_nanoseconds, latency);
+          has_pending_input = false;
+        }
+        // NOTE: Recorded an update at a time, so playback steps the
+        // simulation the same way whatever the frame rate is
+        for (uint32_t update_index = 0; update_index < update_count;
+             ++update_index) {
+          if (linux_state.is_recording) {
+            linux_record_input(linux_state, new_input);
+          }
+          if (linux_state.is_playing_back) {
+            linux_playback_input(linux_state, new_input);
+          }
+          game_code.update(new_input, game_memory);
+          linux_clear_transitions(new_input);
+        }
 
-        const LinuxWindowDimension dimension =
-            linux_x11_get_window_dimension(display, window);
-        linux_x11_display_buffer_in_window(display, window, gc,
-                                           global_backbuffer, dimension.width,
-                                           dimension.height);
-
-        timespec work_counter = linux_get_wall_clock();
-
-        float work_seconds_elapsed =
-            linux_get_seconds_elapsed(last_counter, work_counter);
-
-        float seconds_elapsed_for_frame = work_seconds_elapsed;
-        if (seconds_elapsed_for_frame < target_seconds_per_frame) {
-          while (seconds_elapsed_for_frame < target_seconds_per_frame) {
-            uint32_t sleep_us = (uint32_t)(1000.0f * 1000.0f *
-                                           (target_seconds_per_frame -
-                                            seconds_elapsed_for_frame));
-            usleep(sleep_us);
-            seconds_elapsed_for_frame =
-                linux_get_seconds_elapsed(last_counter, linux_get_wall_clock());
+        game_memory.backbuffer_lost = global_backbuffer.contents_lost;
+        global_backbuffer.contents_lost = false;
+        game_code.render(buffer, game_memory,
+                         linux_get_update_alpha(update_clock));
+
+        BEGIN_TIMED_BLOCK("audio");
+        if (sound_output.use_mmap) {
+          if (pcm_handle &&
+              !linux_alsa_mmap_write_game_samples(
+                  pcm_handle, game_memory, game_code.get_sound_samples,
+                  sound_output.samples_per_second)) {
+            ++mmap_underrun_count;
           }
         } else {
-          // TODO: Log missed frame rate
+          const uint32_t queued_sample_count =
+              linux_audio_ring_queued(audio_ring);
+          if (queued_sample_count < sound_output.target_queued_sample_count) {
+            linux_audio_ring_write_game_samples(
+                audio_ring, game_memory, game_code.get_sound_samples,
+                sound_output.samples_per_second,
+                sound_output.target_queued_sample_count - queued_sample_count);
+          }
+        }
+
+        END_TIMED_BLOCK("audio");
+
+        BEGIN_TIMED_BLOCK("present");
+        std::array<GameDirtyRect, LINUX_MAX_PRESENT_RECT_COUNT> present_rects;
+        uint32_t present_rect_count = 1;
+        if (global_present_everything) {
+          present_rects[0] = GameDirtyRect{0, 0, buffer.width, buffer.height};
+          global_present_everything = false;
+        } else {
+          present_rect_count = linux_coalesce_dirty_rects(
+              game_memory.dirty_rects, present_rects.data(),
+              present_rects.size());
+        }
+        if (game_buffer.memory) {
+          linux_x11_wait_for_shm_put(display, global_backbuffer);
+          for (uint32_t i = 0; i < present_rect_count; ++i) {
+            present_rects[i] = linux_scale_dirty_rect(
+                present_rects[i], game_buffer, window_buffer);
+            if (use_bilinear_scaling) {
+              linux_scale_bilinear(game_buffer, window_buffer,
+                                   present_rects[i]);
+            } else {
+              linux_scale_nearest(game_buffer, window_buffer,
+                                  present_rects[i]);
+            }
+          }
+        }
+        const LinuxWindowDimension dimension =
+            linux_x11_get_window_dimension(display, window);
+        linux_x11_display_buffer_in_window(
+            display, window, gc, global_backbuffer, dimension.width,
+            dimension.height, present_rects.data(), present_rect_count);
+        END_TIMED_BLOCK("present");
+
+        // NOTE: A frame without updates leaves its input to the next one
+        if (update_count > 0) {
+          std::swap(old_input, new_input);
+          linux_begin_input_frame(new_input, old_input);
+          keyboard_controller = get_controller(new_input, 0);
+          old_controller = get_controller(old_input, controller_index);
+          new_controller = get_controller(new_input, controller_index);
         }
 
-        std::swap(old_input, new_input);
+        // NOTE: Until the frame is over, events are handled as they arrive
+        // and go into the next frame's input
+        BEGIN_TIMED_BLOCK("wait");
+        linux_check_frame_deadline(pacer);
+        while (running) {
+          // NOTE: Xlib may have already read events off the connection (e.g.
+          // while waiting for a put), those won't wake epoll up
+          got_input = linux_x11_process_pending_messages(
+              display, linux_state, keyboard_controller);
+
+          const uint64_t now = linux_get_monotonic_nanoseconds();
+          const uint64_t spin_start = linux_get_frame_spin_start(pacer);
+          // NOTE: Without the event loop the pacer does all the sleeping
+          const bool is_done_waiting =
+              event_loop.epoll_fd < 0 || now >= spin_start;
+          uint32_t ready_sources = 0;
+          if (!is_done_waiting) {
+            ready_sources =
+                linux_wait_for_events(event_loop, spin_start - now);
+          }
 
-        uint64_t end_cycle_count = __rdtsc();
-        [[maybe_unused]] float cycles_elapsed =
-            (float)(end_cycle_count - last_cycle_count) / (1000.0f * 1000.0f);
+          if (controller_found >= 0 &&
+              (ready_sources & (1u << (uint32_t)LinuxEventSource::Evdev))) {
+            got_input |= linux_evdev_process_events(
+                controller_evdev, old_controller, new_controller,
+                dpad_x_active, dpad_y_active);
+          }
+          if (got_input && !has_pending_input) {
+            has_pending_input = true;
+            pending_input_time = linux_get_wall_clock();
+          }
+          // NOTE: Keeps the device topped up a period at a time, rather than
+          // only once per frame
+          if (pcm_handle &&
+              (ready_sources & (1u << (uint32_t)LinuxEventSource::Alsa)) &&
+              !linux_alsa_mmap_write_game_samples(
+                  pcm_handle, game_memory, game_code.get_sound_samples,
+                  sound_output.samples_per_second)) {
+            ++mmap_underrun_count;
+          }
 
-        timespec end_counter = linux_get_wall_clock();
-        last_counter = end_counter;
+          if (is_done_waiting) {
+            break;
+          }
+        }
+        frame_nanoseconds = linux_wait_for_frame_deadline(pacer);
+        END_TIMED_BLOCK("wait");
+
+        const LinuxPageFaultCounts end_page_faults =
+            linux_get_page_fault_counts();
+        linux_count_frame_page_faults(
+            frame_page_faults,
+            linux_get_page_faults_elapsed(last_page_faults, end_page_faults));
+        last_page_faults = end_page_faults;
+#if HANDMADE_INTERNAL
+        if (game_memory.debug_table) {
+          linux_collate_debug_frame(*game_memory.debug_table);
+          // NOTE: About once a second
+          if (pacer.frame_count % frame_hz == 0) {
+            linux_print_debug_stats(*game_memory.debug_table);
+          }
+          if (global_write_debug_trace) {
+            linux_write_chrome_trace(*game_memory.debug_table,
+                                     "handmade_trace.json");
+            global_write_debug_trace = false;
+          }
+        }
+#endif
+      }
 
-        last_cycle_count = end_cycle_count;
+      linux_stop_audio_thread(audio_thread);
+      if (audio_thread.underrun_count) {
+        fprintf(stdout, "audio: ring ran dry %u times\n",
+                audio_thread.underrun_count.load());
+      }
+      if (mmap_underrun_count) {
+        fprintf(stdout, "audio: device underran %u times\n",
+                mmap_underrun_count);
+      }
+      linux_print_frame_pacer_stats(pacer);
+      linux_print_frame_page_faults(frame_page_faults);
+      if (update_clock.dropped_update_count) {
+        fprintf(stdout, "simulation: fell %lu updates behind real time\n",
+                update_clock.dropped_update_count);
       }
+      if (input_latency.frame_count) {
+        fprintf(stdout,
+                "input: %lu frames with input, waited %.2f ms on average "
+                "(%.2f ms at most) before the game saw it\n",
+                input_latency.frame_count,
+                (double)input_latency.total_nanoseconds /
+                    (double)input_latency.frame_count / 1000000.0,
+                (double)input_latency.max_nanoseconds / 1000000.0);
+      }
+
+      linux_print_memory_usage(game_memory);
     } else {
       // TODO: log
     }
@@ -1,10 +1,26 @@
 #pragma once
 
+#include "handmade.h"
+
 #include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
 #include <alsa/asoundlib.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
 
 struct LinuxX11OffscreenBuffer {
   XImage image;
+  // NOTE: Only set when the buffer lives in a MIT-SHM segment
+  XImage *shm_image;
+  XShmSegmentInfo shm_info;
+  bool shm_put_pending;
+  // NOTE: Set whenever the memory is reallocated, until the game is told
+  bool contents_lost;
   void *memory;
   uint32_t memory_size;
   uint32_t width;
@@ -20,5 +36,117 @@ struct LinuxWindowDimension {
 
 struct LinuxSoundOutput {
   uint32_t samples_per_second;
-  uint32_t samples_per_write;
+  // NOTE: ALSA period, the audio thread wakes up once per period
+  uint32_t period_sample_count;
+  // NOTE: How far ahead of the audio thread the game writes. This is the
+  // slack a slow frame can eat before the ring runs dry.
+  uint32_t target_queued_sample_count;
+  // NOTE: No audio thread or ring, the game writes into the device's mmap'd
+  // buffer once per frame, which is then target_queued_sample_count long
+  bool use_mmap;
+};
+
+/*
+ * NOTE: Single producer (main thread, through game_get_sound_samples), single
+ * consumer (audio thread) ring of interleaved stereo samples. Indices count
+ * sample frames and only ever grow, capacity must be a power of two.
+ */
+struct LinuxAudioRing {
+  std::atomic<uint64_t> write_index;
+  std::atomic<uint64_t> read_index;
+  uint32_t capacity;
+  int16_t *samples;
+};
+
+struct LinuxAudioThread {
+  pthread_t thread;
+  snd_pcm_t *pcm_handle;
+  LinuxAudioRing *ring;
+  uint32_t period_sample_count;
+  std::atomic<bool> running;
+  // NOTE: Times the ring was empty when the device wanted samples
+  std::atomic<uint32_t> underrun_count;
+};
+
+enum class LinuxEventSource : uint32_t {
+  X11,
+  Evdev,
+  Alsa,
+};
+
+/*
+ * NOTE: One epoll instance watching the X connection, the controller and, when
+ * the game writes into the sound device directly, the PCM's poll descriptors.
+ * Each registered fd has its source in the high 32 bits of its epoll data,
+ * and for the PCM, the index of its descriptor in the low ones.
+ */
+struct LinuxEventLoop {
+  int epoll_fd;
+  snd_pcm_t *alsa_pcm_handle;
+  std::array<pollfd, 8> alsa_poll_fds;
+  uint32_t alsa_poll_fd_count;
+};
+
+// NOTE: Bucket i counts frames that took less than 2^i page faults, the last
+// one also counts everything past it
+constexpr uint32_t LINUX_PAGE_FAULT_HISTOGRAM_BUCKET_COUNT = 16;
+
+// NOTE: Page faults taken by frames over the whole run. A steady frame
+// shouldn't take any, Xlib, ALSA and snapshot restores still cause some.
+struct LinuxFramePageFaults {
+  uint64_t frame_count;
+  uint64_t minor_count;
+  uint64_t major_count;
+  std::array<uint64_t, LINUX_PAGE_FAULT_HISTOGRAM_BUCKET_COUNT> histogram;
+};
+
+// NOTE: How long input waited between arriving and the game seeing it
+struct LinuxInputLatency {
+  uint64_t frame_count;
+  uint64_t total_nanoseconds;
+  uint64_t max_nanoseconds;
+};
+
+/*
+ * NOTE: Frames end on absolute CLOCK_MONOTONIC deadlines one frame period
+ * apart, so lateness in one frame doesn't push the following ones back. The
+ * pacer sleeps until spin_nanoseconds before the deadline and spins through
+ * the rest, since sleepers get woken up late by the timer slack plus however
+ * long the scheduler takes.
+ */
+constexpr uint64_t LINUX_FRAME_PACER_SPIN_NANOSECONDS = 500000;
+// NOTE: Bucket i counts frames off by less than 2^i microseconds, the last
+// one also counts everything past it
+constexpr uint32_t LINUX_FRAME_HISTOGRAM_BUCKET_COUNT = 16;
+
+struct LinuxFramePacer {
+  uint64_t target_nanoseconds;
+  uint64_t spin_nanoseconds;
+  uint64_t deadline;
+  // NOTE: The previous frame's deadline, or when it ended if it missed it
+  uint64_t last_deadline;
+  uint64_t last_frame_end;
+
+  uint64_t frame_count;
+  uint64_t missed_deadline_count;
+  // NOTE: How far each frame's length was from the target
+  std::array<uint64_t, LINUX_FRAME_HISTOGRAM_BUCKET_COUNT> jitter_histogram;
+  // NOTE: How late the work was done in frames that missed their deadline
+  std::array<uint64_t, LINUX_FRAME_HISTOGRAM_BUCKET_COUNT> missed_histogram;
+};
+
+/*
+ * NOTE: The game layer, loaded from libhandmade.so next to the executable.
+ * While no library is loaded the entry points are stubs that do nothing.
+ */
+struct LinuxGameCode {
+  void *library;
+  // NOTE: Of the file that was last loaded (or failed to), a rebuilt one is
+  // a new file with a newer write time
+  timespec last_write_time;
+  ino_t inode;
+
+  GameUpdate *update;
+  GameRender *render;
+  GameGetSoundSamples *get_sound_samples;
 };
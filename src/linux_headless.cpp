@@ -0,0 +1,323 @@
+/*
+ * NOTE: Headless platform layer. Runs the game without a display, sound card
+ * or input devices, feeding it a scripted input stream and stepping frames as
+ * fast as possible so the game layer's throughput can be measured anywhere.
+ */
+
+#include "linux_headless.h"
+#include "handmade.h"
+
+#include "handmade.cpp"
+#include "linux_common.cpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+static void linux_headless_print_usage(const char *program_name) {
+  fprintf(stderr,
+          "Usage: %s [--frames N] [--width W] [--height H] [--hz HZ] "
+          "[--threads N] [--verbose] [--hugetlb] [--thp] [--prefault] "
+          "[--trace FILE]\n",
+          program_name);
+}
+
+static bool linux_headless_parse_options(int argc, char **argv,
+                                         LinuxHeadlessOptions &options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (strcmp(arg, "--frames") == 0 && has_value) {
+      options.frame_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--width") == 0 && has_value) {
+      options.width = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--height") == 0 && has_value) {
+      options.height = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--hz") == 0 && has_value) {
+      options.frame_hz = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--threads") == 0 && has_value) {
+      options.worker_thread_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--verbose") == 0) {
+      options.print_frames = true;
+    } else if (strcmp(arg, "--trace") == 0 && has_value) {
+      options.trace_filename = argv[++i];
+    } else if (linux_parse_memory_option(arg, options.memory)) {
+    } else {
+      return false;
+    }
+  }
+
+  return options.frame_count > 0 && options.width > 0 && options.height > 0 &&
+         options.frame_hz > 0;
+}
+
+static void linux_headless_set_button(GameButtonState *new_state,
+                                      const GameButtonState *old_state,
+                                      bool is_down) {
+  new_state->ended_down = is_down;
+  new_state->half_transition_count =
+      (old_state->ended_down != new_state->ended_down) ? 1 : 0;
+}
+
+/*
+ * NOTE: The script only depends on the frame index, so every run feeds the
+ * game exactly the same input stream.
+ */
+static void linux_headless_script_input(GameInput *new_input,
+                                        GameInput *old_input,
+                                        const uint32_t frame_index) {
+  GameControllerInput *keyboard = get_controller(new_input, 0);
+  const GameControllerInput *old_keyboard = get_controller(old_input, 0);
+  keyboard->is_connected = true;
+  keyboard->is_analog = false;
+
+  const bool moving_right = (frame_index / 120) % 2 == 0;
+  linux_headless_set_button(&keyboard->move_right, &old_keyboard->move_right,
+                            moving_right);
+  linux_headless_set_button(&keyboard->move_left, &old_keyboard->move_left,
+                            !moving_right);
+  linux_headless_set_button(&keyboard->action_down, &old_keyboard->action_down,
+                            (frame_index / 30) % 2 == 0);
+
+  GameControllerInput *pad = get_controller(new_input, 1);
+  const GameControllerInput *old_pad = get_controller(old_input, 1);
+  pad->is_connected = true;
+  pad->is_analog = true;
+
+  // NOTE: Triangle wave sweeping the stick through [-1, 1] every 256 frames
+  const float phase = (float)(frame_index % 256) / 128.0f;
+  pad->stick_average_x = phase < 1.0f ? phase * 2.0f - 1.0f
+                                      : 1.0f - (phase - 1.0f) * 2.0f;
+  pad->stick_average_y = -pad->stick_average_x;
+  linux_headless_set_button(&pad->action_down, &old_pad->action_down,
+                            (frame_index / 45) % 2 == 1);
+}
+
+static uint64_t
+linux_headless_percentile(const uint64_t *sorted_values, const uint32_t count,
+                          const uint32_t percentile) {
+  uint32_t index = (uint32_t)(((uint64_t)count * percentile) / 100);
+  if (index >= count) {
+    index = count - 1;
+  }
+  return sorted_values[index];
+}
+
+static void linux_headless_report(LinuxHeadlessFrameTiming *timings,
+                                  const uint32_t frame_count,
+                                  const float total_seconds,
+                                  const uint64_t buffer_pixel_count) {
+  uint64_t *nanoseconds = (uint64_t *)mmap(
+      NULL, 2 * frame_count * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (nanoseconds == MAP_FAILED) {
+    return;
+  }
+  uint64_t *cycles = nanoseconds + frame_count;
+
+  // NOTE: First-touch faults are expected to pile up in the first second of
+  // play, so they are reported separately
+  constexpr uint32_t warmup_frame_count = 60;
+  LinuxPageFaultCounts warmup_page_faults = {};
+  LinuxPageFaultCounts steady_page_faults = {};
+  uint64_t total_cycles = 0;
+  uint64_t presented_pixel_count = 0;
+  uint64_t present_rect_count = 0;
+  for (uint32_t i = 0; i < frame_count; ++i) {
+    nanoseconds[i] = timings[i].nanoseconds;
+    cycles[i] = timings[i].cycles;
+    total_cycles += timings[i].cycles;
+    presented_pixel_count += timings[i].presented_pixel_count;
+    present_rect_count += timings[i].present_rect_count;
+
+    LinuxPageFaultCounts &page_faults =
+        i < warmup_frame_count ? warmup_page_faults : steady_page_faults;
+    page_faults.minor += timings[i].page_faults.minor;
+    page_faults.major += timings[i].page_faults.major;
+  }
+  std::sort(nanoseconds, nanoseconds + frame_count);
+  std::sort(cycles, cycles + frame_count);
+
+  fprintf(stdout, "frames:        %u\n", frame_count);
+  fprintf(stdout, "total:         %.3f s\n", (double)total_seconds);
+  fprintf(stdout, "frames/sec:    %.2f\n",
+          (double)frame_count / (double)total_seconds);
+  fprintf(stdout, "ns/frame:      min %lu  median %lu  p99 %lu  max %lu\n",
+          nanoseconds[0],
+          linux_headless_percentile(nanoseconds, frame_count, 50),
+          linux_headless_percentile(nanoseconds, frame_count, 99),
+          nanoseconds[frame_count - 1]);
+  fprintf(stdout, "cycles/frame:  min %lu  median %lu  p99 %lu  max %lu\n",
+          cycles[0], linux_headless_percentile(cycles, frame_count, 50),
+          linux_headless_percentile(cycles, frame_count, 99),
+          cycles[frame_count - 1]);
+  fprintf(stdout, "mean cycles:   %lu\n", total_cycles / frame_count);
+  fprintf(stdout,
+          "page faults:   first %u frames %lu minor / %lu major, "
+          "after %lu minor / %lu major\n",
+          warmup_frame_count, warmup_page_faults.minor,
+          warmup_page_faults.major, steady_page_faults.minor,
+          steady_page_faults.major);
+  fprintf(stdout, "presented:     %.2f%% of the pixels, %.2f rects/frame\n",
+          100.0 * (double)presented_pixel_count /
+              ((double)buffer_pixel_count * frame_count),
+          (double)present_rect_count / frame_count);
+
+  munmap(nanoseconds, 2 * frame_count * sizeof(uint64_t));
+}
+
+int main(int argc, char **argv) {
+  LinuxHeadlessOptions options{
+      1000, 1920, 1080, 48000, 60, linux_get_default_worker_thread_count(),
+      false, {}, NULL};
+  if (!linux_headless_parse_options(argc, argv, options)) {
+    linux_headless_print_usage(argv[0]);
+    return 1;
+  }
+
+  const uint32_t bytes_per_pixel = 4;
+  const uint32_t pitch = options.width * bytes_per_pixel;
+  const uint64_t backbuffer_size = (uint64_t)pitch * options.height;
+  void *backbuffer_memory =
+      mmap(NULL, (size_t)backbuffer_size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  const uint32_t samples_per_frame =
+      options.samples_per_second / options.frame_hz;
+  int16_t *samples = static_cast<int16_t *>(
+      mmap(NULL, samples_per_frame * CHANNELS * sizeof(int16_t),
+           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+  LinuxHeadlessFrameTiming *timings =
+      static_cast<LinuxHeadlessFrameTiming *>(mmap(
+          NULL, options.frame_count * sizeof(LinuxHeadlessFrameTiming),
+          PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+  LinuxState linux_state = {};
+  GameMemory game_memory = {};
+  game_memory.permanent_storage_size = MEGABYTES(64);
+  game_memory.transient_storage_size = GIGABYTES(1);
+
+  if (backbuffer_memory == MAP_FAILED || samples == MAP_FAILED ||
+      timings == MAP_FAILED ||
+      !linux_allocate_game_memory(linux_state, game_memory, options.memory)) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    return 1;
+  }
+
+  // NOTE: The backbuffer is first touched by the first frame too
+  if (options.memory.prefault_permanent_storage) {
+    linux_prefault(backbuffer_memory, backbuffer_size);
+  }
+
+  static LinuxWorkQueues work_queues;
+  linux_make_work_queues(&work_queues, options.worker_thread_count);
+  game_memory.high_priority_queue = &work_queues.high_priority;
+  game_memory.low_priority_queue = &work_queues.low_priority;
+  game_memory.platform_add_entry = linux_add_entry;
+  game_memory.platform_complete_all_work = linux_complete_all_work;
+  game_memory.platform_open_file = linux_open_file;
+  game_memory.platform_read_data_from_file = linux_read_data_from_file;
+  game_memory.platform_close_file = linux_close_file;
+#if HANDMADE_INTERNAL
+  game_memory.DEBUG_platform_write_entire_file =
+      DEBUG_platform_write_entire_file;
+  game_memory.debug_table = linux_allocate_debug_table();
+  debug_global_table = game_memory.debug_table;
+#endif
+
+  const GameOffscreenBuffer buffer{backbuffer_memory, options.width,
+                                   options.height, pitch};
+  const GameSoundOutputBuffer sound_buffer{options.samples_per_second,
+                                           samples_per_frame, samples};
+
+  GameInput input[2] = {};
+  GameInput *new_input = &input[0];
+  GameInput *old_input = &input[1];
+
+  // NOTE: Every frame is as long as it would be on a display, so runs step
+  // the simulation the same way however fast they go
+  LinuxUpdateClock update_clock = {};
+  const uint64_t frame_nanoseconds = 1000000000ull / options.frame_hz;
+  uint64_t update_count = 0;
+
+  const timespec run_start = linux_get_wall_clock();
+  for (uint32_t frame_index = 0; frame_index < options.frame_count;
+       ++frame_index) {
+    linux_headless_script_input(new_input, old_input, frame_index);
+
+    const LinuxPageFaultCounts start_page_faults =
+        linux_get_page_fault_counts();
+    const timespec frame_start = linux_get_wall_clock();
+    const uint64_t start_cycle_count = __rdtsc();
+
+    const uint32_t frame_update_count =
+        linux_advance_update_clock(update_clock, frame_nanoseconds);
+    for (uint32_t update_index = 0; update_index < frame_update_count;
+         ++update_index) {
+      game_update(new_input, game_memory);
+      linux_clear_transitions(new_input);
+    }
+    game_render(buffer, game_memory, linux_get_update_alpha(update_clock));
+    game_get_sound_samples(game_memory, sound_buffer);
+    update_count += frame_update_count;
+
+    const uint64_t end_cycle_count = __rdtsc();
+    const timespec frame_end = linux_get_wall_clock();
+
+    LinuxHeadlessFrameTiming &timing = timings[frame_index];
+    timing.nanoseconds = linux_get_nanoseconds_elapsed(frame_start, frame_end);
+    timing.cycles = end_cycle_count - start_cycle_count;
+    timing.page_faults = linux_get_page_faults_elapsed(
+        start_page_faults, linux_get_page_fault_counts());
+
+    std::array<GameDirtyRect, LINUX_MAX_PRESENT_RECT_COUNT> present_rects;
+    timing.present_rect_count = linux_coalesce_dirty_rects(
+        game_memory.dirty_rects, present_rects.data(), present_rects.size());
+    timing.presented_pixel_count = 0;
+    for (uint32_t i = 0; i < timing.present_rect_count; ++i) {
+      const GameDirtyRect &rect = present_rects[i];
+      timing.presented_pixel_count +=
+          (uint64_t)(rect.max_x - rect.min_x) * (rect.max_y - rect.min_y);
+    }
+    if (options.print_frames) {
+      fprintf(stdout,
+              "frame %u: %lu ns, %lu cycles, %lu minor / %lu major faults\n",
+              frame_index, timing.nanoseconds, timing.cycles,
+              timing.page_faults.minor, timing.page_faults.major);
+    }
+#if HANDMADE_INTERNAL
+    if (game_memory.debug_table) {
+      linux_collate_debug_frame(*game_memory.debug_table);
+    }
+#endif
+
+    // NOTE: A frame without updates leaves its input to the next one
+    if (frame_update_count > 0) {
+      std::swap(old_input, new_input);
+    }
+  }
+  const timespec run_end = linux_get_wall_clock();
+
+  linux_headless_report(timings, options.frame_count,
+                        linux_get_seconds_elapsed(run_start, run_end),
+                        (uint64_t)options.width * options.height);
+  fprintf(stdout, "updates:       %lu at %u Hz, %lu dropped\n", update_count,
+          GAME_UPDATE_HZ, update_clock.dropped_update_count);
+  linux_print_memory_usage(game_memory);
+#if HANDMADE_INTERNAL
+  if (game_memory.debug_table) {
+    linux_print_debug_stats(*game_memory.debug_table);
+    if (options.trace_filename) {
+      linux_write_chrome_trace(*game_memory.debug_table,
+                               options.trace_filename);
+    }
+  }
+#endif
+
+  return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "linux_common.h"
+
+#include <cstdint>
+
+struct LinuxHeadlessOptions {
+  uint32_t frame_count;
+  uint32_t width;
+  uint32_t height;
+  uint32_t samples_per_second;
+  // NOTE: How many frames the run pretends to render per second, the game
+  // still updates at GAME_UPDATE_HZ
+  uint32_t frame_hz;
+  uint32_t worker_thread_count;
+  bool print_frames;
+  LinuxMemoryOptions memory;
+  // NOTE: Where to write the profiler's Chrome trace at the end, if anywhere
+  const char *trace_filename;
+};
+
+struct LinuxHeadlessFrameTiming {
+  uint64_t nanoseconds;
+  uint64_t cycles;
+  LinuxPageFaultCounts page_faults;
+  // NOTE: What a windowed platform would have had to present
+  uint64_t presented_pixel_count;
+  uint32_t present_rect_count;
+};
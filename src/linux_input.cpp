@@ -0,0 +1,43 @@
+/*
+ * NOTE: Turns the platform's raw input into GameButtonStates and stick
+ * values. Shared by the X11 platform and the benchmarks, so it must not pull
+ * in X11 or libevdev, only the kernel's input_event.
+ */
+
+#include "handmade.h"
+
+#include <cstdint>
+#include <linux/input.h>
+
+static void linux_process_keyboard_message(GameButtonState *new_state,
+                                           bool is_down) {
+  ASSERT(new_state->ended_down != is_down);
+  new_state->ended_down = is_down;
+  ++new_state->half_transition_count;
+}
+
+static void
+linux_process_evdev_digital_button(input_event input_event,
+                                   const GameButtonState *old_state,
+                                   int button_code,
+                                   GameButtonState *new_state) {
+  new_state->ended_down =
+      input_event.code == button_code && input_event.value == 1;
+  new_state->half_transition_count =
+      (old_state->ended_down != new_state->ended_down) ? 1 : 0;
+}
+
+static float linux_process_evdev_stick_value(int32_t value,
+                                             const int32_t deadzone) {
+  float result = 0.0f;
+  if (value < 128 - deadzone || value > 128 + deadzone) {
+    result = (float)(value - 128);
+    if (result < 0) {
+      result /= 128.0f;
+    } else {
+      result /= 127.0f;
+    }
+  }
+
+  return result;
+}